@@ -713,6 +713,14 @@ public:
     return false;
   }
 
+  /// Return the cycles a conditional branch out of \p MBB costs on top of the
+  /// misprediction penalty of the scheduling model, e.g., because a later pass
+  /// rewrites the branch into a longer sequence. Early if-conversion accepts
+  /// that much more critical path, and runs for \p MBB whenever this is not 0.
+  virtual unsigned getExtraBranchCost(const MachineBasicBlock &MBB) const {
+    return 0;
+  }
+
   /// Return true if it is possible to insert a select
   /// instruction that chooses between TrueReg and FalseReg based on the
   /// condition code in Cond.
@@ -808,6 +808,14 @@ public:
            isOperationLegalOrCustom(ISD::BRIND, MVT::Other);
   }
 
+  /// Return the cost of a conditional branch when lowering \p SI, relative to
+  /// the compare and branch the switch lowering heuristics assume. Targets
+  /// that later rewrite conditional branches into longer sequences return more
+  /// than 1, which makes jump tables and bit tests pay off sooner.
+  virtual unsigned getSwitchBranchCost(const SwitchInst *SI) const {
+    return 1;
+  }
+
   /// Check whether the range [Low,High] fits in a machine word.
   bool rangeFitsInWord(const APInt &Low, const APInt &High,
                        const DataLayout &DL) const {
@@ -827,7 +835,8 @@ public:
   virtual bool isSuitableForJumpTable(const SwitchInst *SI, uint64_t NumCases,
                                       uint64_t Range) const {
     const bool OptForSize = SI->getParent()->getParent()->optForSize();
-    const unsigned MinDensity = getMinimumJumpTableDensity(OptForSize);
+    const unsigned MinDensity =
+        getMinimumJumpTableDensity(OptForSize) / getSwitchBranchCost(SI);
     const unsigned MaxJumpTableSize =
         OptForSize || getMaximumJumpTableSize() == 0
             ? UINT_MAX
@@ -39,6 +39,10 @@ struct Config {
   std::string CPU;
   TargetOptions Options;
   std::vector<std::string> MAttrs;
+  /// Backend options the linker parsed from the command line (-mllvm,
+  /// -plugin-opt), e.g., the branch conversion options of the X86 backend.
+  /// They change the generated code, but live in global cl::opts.
+  std::vector<std::string> BackendOptions;
   Optional<Reloc::Model> RelocModel = Reloc::PIC_;
   Optional<CodeModel::Model> CodeModel = None;
   CodeGenOpt::Level CGOptLevel = CodeGenOpt::Default;
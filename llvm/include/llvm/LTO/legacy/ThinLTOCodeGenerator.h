@@ -54,6 +54,7 @@ struct TargetMachineBuilder {
   Triple TheTriple;
   std::string MCpu;
   std::string MAttr;
+  std::vector<std::string> BackendOptions;
   TargetOptions Options;
   Optional<Reloc::Model> RelocModel;
   CodeGenOpt::Level CGOptLevel = CodeGenOpt::Aggressive;
@@ -204,6 +205,12 @@ public:
   /// Subtarget attributes
   void setAttr(std::string MAttr) { TMBuilder.MAttr = std::move(MAttr); }
 
+  /// Backend options that were parsed from the command line, only used to
+  /// compute the cache key.
+  void setBackendOptions(std::vector<std::string> Options) {
+    TMBuilder.BackendOptions = std::move(Options);
+  }
+
   /// TargetMachine options
   void setTargetOptions(TargetOptions Options) {
     TMBuilder.Options = std::move(Options);
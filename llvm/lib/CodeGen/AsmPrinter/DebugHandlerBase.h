@@ -69,9 +69,9 @@ protected:
   MCSymbol *PrevLabel = nullptr;
   const MachineBasicBlock *PrevInstBB = nullptr;
 
-  /// This location indicates end of function prologue and beginning of
+  /// This instruction indicates end of function prologue and beginning of
   /// function body.
-  DebugLoc PrologEndLoc;
+  const MachineInstr *PrologEndMI = nullptr;
 
   /// If nonnull, stores the current machine instruction we're processing.
   const MachineInstr *CurMI = nullptr;
@@ -1176,7 +1176,7 @@ void DwarfDebug::beginInstruction(const MachineInstr *MI) {
   unsigned LastAsmLine =
       Asm->OutStreamer->getContext().getCurrentDwarfLoc().getLine();
 
-  if (DL == PrevInstLoc) {
+  if (DL == PrevInstLoc && MI != PrologEndMI) {
     // If we have an ongoing unspecified location, nothing to do here.
     if (!DL)
       return;
@@ -1227,9 +1227,9 @@ void DwarfDebug::beginInstruction(const MachineInstr *MI) {
   if (PrevInstLoc && DL.getLine() == 0 && LastAsmLine == 0)
     return;
   unsigned Flags = 0;
-  if (DL == PrologEndLoc) {
+  if (MI == PrologEndMI) {
     Flags |= DWARF2_FLAG_PROLOGUE_END | DWARF2_FLAG_IS_STMT;
-    PrologEndLoc = DebugLoc();
+    PrologEndMI = nullptr;
   }
   // If the line changed, we call that a new statement; unless we went to
   // line 0 and came back, in which case it is not a new statement.
@@ -1245,15 +1245,25 @@ void DwarfDebug::beginInstruction(const MachineInstr *MI) {
     PrevInstLoc = DL;
 }
 
-static DebugLoc findPrologueEndLoc(const MachineFunction *MF) {
+static const MachineInstr *findPrologueEndInstr(const MachineFunction *MF) {
+  // Blocks laid out in front of the entry block, e.g., the trampolines of X86
+  // branch conversion, do not run before the function body.
+  const BasicBlock *Entry = &MF->getFunction().getEntryBlock();
+  auto Begin = MF->begin();
+  for (auto I = MF->begin(), E = MF->end(); I != E; ++I)
+    if (I->getBasicBlock() == Entry) {
+      Begin = I;
+      break;
+    }
+
   // First known non-DBG_VALUE and non-frame setup location marks
   // the beginning of the function body.
-  for (const auto &MBB : *MF)
-    for (const auto &MI : MBB)
+  for (auto I = Begin, E = MF->end(); I != E; ++I)
+    for (const auto &MI : *I)
       if (!MI.isMetaInstruction() && !MI.getFlag(MachineInstr::FrameSetup) &&
           MI.getDebugLoc())
-        return MI.getDebugLoc();
-  return DebugLoc();
+        return &MI;
+  return nullptr;
 }
 
 // Gather pre-function debug information.  Assumes being called immediately
@@ -1278,11 +1288,12 @@ void DwarfDebug::beginFunctionImpl(const MachineFunction *MF) {
     Asm->OutStreamer->getContext().setDwarfCompileUnitID(CU.getUniqueID());
 
   // Record beginning of function.
-  PrologEndLoc = findPrologueEndLoc(MF);
-  if (PrologEndLoc) {
+  PrologEndMI = findPrologueEndInstr(MF);
+  if (PrologEndMI) {
     // We'd like to list the prologue as "not statements" but GDB behaves
     // poorly if we do that. Revisit this with caution/GDB (7.5+) testing.
-    auto *SP = PrologEndLoc->getInlinedAtScope()->getSubprogram();
+    auto *SP =
+        PrologEndMI->getDebugLoc()->getInlinedAtScope()->getSubprogram();
     recordSourceLine(SP->getScopeLine(), 0, SP, DWARF2_FLAG_IS_STMT);
   }
 }
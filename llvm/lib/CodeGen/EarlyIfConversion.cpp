@@ -590,6 +590,7 @@ class EarlyIfConverter : public MachineFunctionPass {
   const TargetInstrInfo *TII;
   const TargetRegisterInfo *TRI;
   MCSchedModel SchedModel;
+  bool EnabledByTarget;
   MachineRegisterInfo *MRI;
   MachineDominatorTree *DomTree;
   MachineLoopInfo *Loops;
@@ -683,6 +684,11 @@ static unsigned adjCycles(unsigned Cyc, int Delta) {
 /// Return true if the conversion is a good idea.
 ///
 bool EarlyIfConverter::shouldConvertIf() {
+  // Without the subtarget asking for it, only heads whose branch costs extra.
+  unsigned ExtraBranchCost = TII->getExtraBranchCost(*IfConv.Head);
+  if (!EnabledByTarget && !ExtraBranchCost)
+    return false;
+
   // Stress testing mode disables all cost considerations.
   if (Stress)
     return true;
@@ -697,7 +703,7 @@ bool EarlyIfConverter::shouldConvertIf() {
                               FBBTrace.getCriticalPath());
 
   // Set a somewhat arbitrary limit on the critical path extension we accept.
-  unsigned CritLimit = SchedModel.MispredictPenalty/2;
+  unsigned CritLimit = (SchedModel.MispredictPenalty + ExtraBranchCost)/2;
 
   // If-conversion only makes sense when there is unexploited ILP. Compute the
   // maximum-ILP resource length of the trace after if-conversion. Compare it
@@ -790,10 +796,14 @@ bool EarlyIfConverter::runOnMachineFunction(MachineFunction &MF) {
 
   // Only run if conversion if the target wants it.
   const TargetSubtargetInfo &STI = MF.getSubtarget();
-  if (!STI.enableEarlyIfConversion())
+  TII = STI.getInstrInfo();
+  EnabledByTarget = STI.enableEarlyIfConversion();
+  if (!EnabledByTarget &&
+      llvm::none_of(MF, [&](const MachineBasicBlock &MBB) {
+        return TII->getExtraBranchCost(MBB) != 0;
+      }))
     return false;
 
-  TII = STI.getInstrInfo();
   TRI = STI.getRegisterInfo();
   SchedModel = STI.getSchedModel();
   MRI = &MF.getRegInfo();
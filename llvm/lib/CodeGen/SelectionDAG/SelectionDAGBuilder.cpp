@@ -9296,7 +9296,15 @@ bool SelectionDAGBuilder::buildBitTests(CaseClusterVector &Clusters,
 
   const TargetLowering &TLI = DAG.getTargetLoweringInfo();
   const DataLayout &DL = DAG.getDataLayout();
-  if (!TLI.isSuitableForBitTests(NumDests, NumCmps, Low, High, DL))
+  unsigned BranchCost = TLI.getSwitchBranchCost(SI);
+  if (BranchCost > 1) {
+    // With expensive branches, compare the cost of the range check and one
+    // test per destination (plus the shift and a mask per test) with the
+    // cost of one compare per case.
+    if (!TLI.rangeFitsInWord(Low, High, DL) ||
+        (1 + NumDests) * BranchCost + 1 + NumDests >= NumCmps * BranchCost)
+      return false;
+  } else if (!TLI.isSuitableForBitTests(NumDests, NumCmps, Low, High, DL))
     return false;
 
   APInt LowBound;
@@ -10000,6 +10008,10 @@ void SelectionDAGBuilder::visitSwitch(const SwitchInst &SI) {
   });
 
   assert(!Clusters.empty());
+  // Expensive branches are worth the balanced tree even when optimizing for
+  // size, as a linear chain puts every compare on the path to the last case.
+  bool ExpensiveBranches =
+      DAG.getTargetLoweringInfo().getSwitchBranchCost(&SI) > 1;
   SwitchWorkList WorkList;
   CaseClusterIt First = Clusters.begin();
   CaseClusterIt Last = Clusters.end() - 1;
@@ -10018,7 +10030,8 @@ void SelectionDAGBuilder::visitSwitch(const SwitchInst &SI) {
     unsigned NumClusters = W.LastCluster - W.FirstCluster + 1;
 
     if (NumClusters > 3 && TM.getOptLevel() != CodeGenOpt::None &&
-        !DefaultMBB->getParent()->getFunction().optForMinSize()) {
+        (ExpensiveBranches ||
+         !DefaultMBB->getParent()->getFunction().optForMinSize())) {
       // For optimized builds, lower large range as a balanced binary tree.
       splitWorkItem(WorkList, W, SI.getCondition(), SwitchMBB);
       continue;
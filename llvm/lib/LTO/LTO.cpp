@@ -116,6 +116,8 @@ static void computeCacheKey(
   AddUnsigned((unsigned)Conf.Options.DebuggerTuning);
   for (auto &A : Conf.MAttrs)
     AddString(A);
+  for (auto &O : Conf.BackendOptions)
+    AddString(O);
   if (Conf.RelocModel)
     AddUnsigned(*Conf.RelocModel);
   else
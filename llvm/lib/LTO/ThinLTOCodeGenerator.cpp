@@ -345,6 +345,8 @@ public:
     AddUnsigned(TMBuilder.Options.DataSections);
     AddUnsigned((unsigned)TMBuilder.Options.DebuggerTuning);
     AddString(TMBuilder.MAttr);
+    for (auto &O : TMBuilder.BackendOptions)
+      AddString(O);
     if (TMBuilder.RelocModel)
       AddUnsigned(*TMBuilder.RelocModel);
     AddUnsigned(TMBuilder.CGOptLevel);
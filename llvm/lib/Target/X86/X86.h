@@ -19,9 +19,12 @@
 
 namespace llvm {
 
+class Function;
 class FunctionPass;
 class ImmutablePass;
+class Instruction;
 class InstructionSelector;
+class MachineBasicBlock;
 class ModulePass;
 class PassRegistry;
 class X86RegisterBankInfo;
@@ -106,8 +109,66 @@ FunctionPass *createX86EvexToVexInsts();
 /// This pass creates the thunks for the retpoline feature.
 FunctionPass *createX86RetpolineThunksPass();
 
-/// This pass converts the branches into Cmovs.
-FunctionPass *createX86BranchConversionPass();
+/// This pass converts the branches into Cmovs. Functions are converted if they
+/// carry the "branch-shadow-protect" attribute, or if they carry neither that
+/// nor "no-branch-shadow-protect" and conversion is enabled for the module,
+/// either by \p ConvertByDefault or by the "branch-shadow-protect" module flag.
+/// If \p SecretOnly is set, only conditional branches marked by the secret
+/// dependence analysis are converted, all others are left as native jumps.
+/// If \p PreLayout is set, the pass runs before block placement and keeps the
+/// CFG exact, so that the trampolines can be laid out like any other block.
+FunctionPass *createX86BranchConversionPass(bool ConvertByDefault,
+                                            bool SecretOnly, bool PreLayout);
+
+/// Return true if a branch conversion pass created with \p ConvertByDefault
+/// converts the branches of \p F. The "branch-shadow-protect" and
+/// "no-branch-shadow-protect" attributes take precedence over the default,
+/// which the "branch-shadow-protect" module flag can turn on.
+bool isBranchConversionEnabled(const Function &F, bool ConvertByDefault);
+
+/// Return true if the branch conversion pass of the X86 pipeline converts the
+/// branches of \p F, i.e., with -x86-branch-conversion as the default.
+bool isBranchConversionEnabled(const Function &F);
+
+/// Return true if the branch conversion pass of the X86 pipeline converts a
+/// conditional branch out of \p MBB, or replacing the IR terminator \p Term.
+/// With -x86-bc-secret-only, that is only the case if the terminator of the
+/// block is marked by the secret dependence analysis. Earlier passes use this
+/// to avoid creating branches that would become trampoline pairs.
+bool isBranchConverted(const MachineBasicBlock &MBB);
+bool isBranchConverted(const Instruction &Term);
+
+/// Instructions a converted conditional branch executes on either path: two
+/// LEAs and a CMOV that select the trampoline, the indirect jump of the fake
+/// block and the jump of the trampoline.
+const unsigned BranchConversionSiteInstrs = 5;
+
+/// Instructions the path not taken adds when its skip lane hops over the next
+/// converted block: an LEA of its next trampoline and the jumps of the fake
+/// block and the trampoline.
+const unsigned BranchConversionHopInstrs = 3;
+
+/// This pass checks that block placement did not duplicate any branch site of
+/// the functions converted before layout.
+FunctionPass *createX86BranchConversionVerifierPass();
+
+/// This pass marks the terminators that depend on annotated secrets, so that
+/// branch conversion can be limited to those.
+ModulePass *createX86SecretDependencePass();
+
+/// How call sites choose between a converted function and its native clone.
+enum class BranchConversionDispatch { None, Flag, Context };
+
+/// This pass clones the functions that branch conversion converts into native
+/// versions that are left alone, and redirects direct call sites to them
+/// according to \p Dispatch: on a global flag the enclave sets at run time, or
+/// statically for calls from functions that are not converted themselves.
+ModulePass *createX86BranchConversionMultiversionPass(BranchConversionDispatch Dispatch);
+
+/// This pass orders the functions that branch conversion converts by the call
+/// graph and profile, so that their trampolines, emitted in module order, are
+/// laid out for the whole LTO module.
+ModulePass *createX86BranchConversionLayoutPass();
 
 
 
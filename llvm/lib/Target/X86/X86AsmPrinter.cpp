@@ -18,11 +18,16 @@
 #include "MCTargetDesc/X86TargetStreamer.h"
 #include "X86InstrInfo.h"
 #include "X86MachineFunctionInfo.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/BinaryFormat/COFF.h"
+#include "llvm/BinaryFormat/ELF.h"
 #include "llvm/CodeGen/MachineConstantPool.h"
+#include "llvm/CodeGen/MachineJumpTableInfo.h"
 #include "llvm/CodeGen/MachineModuleInfoImpls.h"
 #include "llvm/CodeGen/MachineValueType.h"
+#include "llvm/CodeGen/TargetLowering.h"
 #include "llvm/CodeGen/TargetLoweringObjectFileImpl.h"
+#include "llvm/IR/Comdat.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Mangler.h"
 #include "llvm/IR/Module.h"
@@ -31,6 +36,7 @@
 #include "llvm/MC/MCContext.h"
 #include "llvm/MC/MCExpr.h"
 #include "llvm/MC/MCSectionCOFF.h"
+#include "llvm/MC/MCSectionELF.h"
 #include "llvm/MC/MCSectionMachO.h"
 #include "llvm/MC/MCStreamer.h"
 #include "llvm/MC/MCSymbol.h"
@@ -72,18 +78,231 @@ bool X86AsmPrinter::runOnMachineFunction(MachineFunction &MF) {
     OutStreamer->EndCOFFSymbolDef();
   }
 
+  if (MF.getInfo<X86MachineFunctionInfo>()->hasTrampolineTable())
+    collectTrampolineFixups();
+
   // Emit the rest of the function body.
   EmitFunctionBody();
 
   // Emit the XRay table for this function.
   emitXRayTable();
 
+  // Emit the trampoline table of branch conversion for this function.
+  emitTrampolineTable();
+
   EmitFPOData = false;
 
   // We didn't modify anything.
   return false;
 }
 
+/// EmitBasicBlockStart - Switch to the trampoline section in front of the
+/// first trampoline block placed there by branch conversion. The section is
+/// put into the function's COMDAT group, so it is dropped along with it.
+/// Trampoline blocks with a symbol of their own get it after their label.
+void X86AsmPrinter::EmitBasicBlockStart(const MachineBasicBlock &MBB) const {
+  const auto *X86FI = MF->getInfo<X86MachineFunctionInfo>();
+  if (&MBB == X86FI->getFirstTrampoline()) {
+    unsigned Flags = ELF::SHF_ALLOC | ELF::SHF_EXECINSTR;
+    StringRef Group = "";
+    if (const Comdat *C = MF->getFunction().getComdat()) {
+      Flags |= ELF::SHF_GROUP;
+      Group = C->getName();
+    }
+    MCSection *Section = OutContext.getELFSection(
+        X86FI->getTrampolineSection(), ELF::SHT_PROGBITS, Flags, 0, Group);
+
+    OutStreamer->PushSection();
+    OutStreamer->SwitchSection(Section);
+    OutStreamer->EmitCodeAlignment(X86FI->getTrampolineAlignment());
+  }
+
+  AsmPrinter::EmitBasicBlockStart(MBB);
+
+  if (X86FI->hasTrampolineSymbol(&MBB)) {
+    MCSymbol *Sym = getTrampolineSymbol(MBB);
+    OutStreamer->EmitSymbolAttribute(Sym, MCSA_ELF_TypeFunction);
+    OutStreamer->EmitLabel(Sym);
+  }
+}
+
+void X86AsmPrinter::EmitBasicBlockEnd(const MachineBasicBlock &MBB) {
+  AsmPrinter::EmitBasicBlockEnd(MBB);
+  SMShadowTracker.emitShadowPadding(*OutStreamer, getSubtargetInfo());
+
+  const auto *X86FI = MF->getInfo<X86MachineFunctionInfo>();
+  if (X86FI->hasTrampolineSymbol(&MBB)) {
+    MCSymbol *Sym = getTrampolineSymbol(MBB);
+    MCSymbol *End = OutContext.createTempSymbol();
+    OutStreamer->EmitLabel(End);
+    OutStreamer->emitELFSize(
+        Sym, MCBinaryExpr::createSub(MCSymbolRefExpr::create(End, OutContext),
+                                     MCSymbolRefExpr::create(Sym, OutContext),
+                                     OutContext));
+  }
+
+  if (&MBB == X86FI->getLastTrampoline()) {
+    if (X86FI->hasTrampolineTable()) {
+      TrampolineRegionEnd = OutContext.createTempSymbol("bcv_tramp_end", true);
+      OutStreamer->EmitLabel(TrampolineRegionEnd);
+    }
+    OutStreamer->PopSection();
+  }
+}
+
+/// getTrampolineSymbol - The local symbol <function>.bcv.tramp.<N> of a
+/// trampoline block, numbered like the block, so that profilers attribute
+/// samples in the trampolines to the function they belong to, even when they
+/// are emitted into a section of their own.
+MCSymbol *
+X86AsmPrinter::getTrampolineSymbol(const MachineBasicBlock &MBB) const {
+  return OutContext.getOrCreateSymbol(CurrentFnSym->getName() + ".bcv.tramp." +
+                                      Twine(MBB.getNumber()));
+}
+
+/// collectTrampolineFixups - Find the references into and out of the
+/// trampoline region of a converted function: jumps and LEAs, whose 32-bit
+/// displacement ends the instruction, and jump table entries. The
+/// instructions get a label behind them when they are emitted.
+void X86AsmPrinter::collectTrampolineFixups() {
+  const auto *X86FI = MF->getInfo<X86MachineFunctionInfo>();
+  bool InRegion = false;
+  for (const auto &MBB : *MF) {
+    InRegion |= &MBB == X86FI->getFirstTrampoline();
+    if (!InRegion)
+      continue;
+    // Trampolines may be moved anywhere, so none may fall through
+    if (MBB.empty() || !MBB.back().isBarrier())
+      report_fatal_error("trampoline block of " + MF->getName() +
+                         " falls through, cannot describe it in the table");
+    Trampolines.push_back(&MBB);
+    if (&MBB == X86FI->getLastTrampoline())
+      break;
+  }
+  SmallPtrSet<const MachineBasicBlock *, 32> Region(Trampolines.begin(),
+                                                    Trampolines.end());
+
+  for (const auto &MBB : *MF) {
+    const MachineBasicBlock *SiteTrampoline =
+        Region.count(&MBB) ? &MBB : nullptr;
+    for (const auto &MI : MBB)
+      for (const auto &MO : MI.operands()) {
+        if (!MO.isMBB() ||
+            (SiteTrampoline == nullptr && !Region.count(MO.getMBB())))
+          continue;
+        if (MI.getOpcode() != X86::JMP_4 && MI.getOpcode() != X86::LEA64r)
+          report_fatal_error("unsupported reference to a trampoline in " +
+                             MF->getName());
+
+        MCSymbol *End = OutContext.createTempSymbol("bcv_fixup", true);
+        TrampolineFixupEnds[&MI] = End;
+        const MCExpr *EndExpr = MCSymbolRefExpr::create(End, OutContext);
+        const MCExpr *Site = MCBinaryExpr::createSub(
+            EndExpr, MCConstantExpr::create(4, OutContext), OutContext);
+        TrampolineFixups.push_back(
+            {Site, EndExpr, MO.getMBB(), SiteTrampoline, 4});
+      }
+  }
+
+  const MachineJumpTableInfo *MJTI = MF->getJumpTableInfo();
+  if (MJTI == nullptr)
+    return;
+
+  const auto &JT = MJTI->getJumpTables();
+  unsigned Width = MJTI->getEntrySize(getDataLayout());
+  for (unsigned JTI = 0, E = JT.size(); JTI != E; ++JTI) {
+    const MCExpr *Table =
+        MCSymbolRefExpr::create(GetJTISymbol(JTI), OutContext);
+    for (unsigned I = 0, N = JT[JTI].MBBs.size(); I != N; ++I) {
+      const MachineBasicBlock *Target = JT[JTI].MBBs[I];
+      if (!Region.count(Target))
+        continue;
+
+      // The entries are emitted as in AsmPrinter::EmitJumpTableEntry
+      const MCExpr *Base = nullptr;
+      switch (MJTI->getEntryKind()) {
+      case MachineJumpTableInfo::EK_BlockAddress:
+        break;
+      case MachineJumpTableInfo::EK_LabelDifference32:
+        Base = MF->getSubtarget().getTargetLowering()
+                   ->getPICJumpTableRelocBaseExpr(MF, JTI, OutContext);
+        break;
+      default:
+        report_fatal_error("unsupported jump table into the trampolines of " +
+                           MF->getName());
+      }
+      const MCExpr *Site = MCBinaryExpr::createAdd(
+          Table, MCConstantExpr::create(I * Width, OutContext), OutContext);
+      TrampolineFixups.push_back({Site, Base, Target, nullptr, Width});
+    }
+  }
+}
+
+/// emitTrampolineTable - Describe the trampoline region of a converted
+/// function, so that a run-time library can permute the trampoline blocks.
+/// Every block gets a range { start, end } in bcv_tramp_ranges. Every
+/// reference into or out of the region gets a fixup in bcv_tramp_fixups:
+///   { site, base, target, site range, target range, width }
+/// The field of width bytes at site holds target - base (just target if base
+/// is 0). The ranges are those containing the site (and base) and the target,
+/// or 0 for addresses outside the region. Both sections are placed in the
+/// COMDAT group of the function, like the trampoline section.
+void X86AsmPrinter::emitTrampolineTable() {
+  if (Trampolines.empty())
+    return;
+
+  unsigned Flags = ELF::SHF_ALLOC | ELF::SHF_WRITE;
+  StringRef Group = "";
+  if (const Comdat *C = MF->getFunction().getComdat()) {
+    Flags |= ELF::SHF_GROUP;
+    Group = C->getName();
+  }
+  MCSection *RangeSection = OutContext.getELFSection(
+      "bcv_tramp_ranges", ELF::SHT_PROGBITS, Flags, 0, Group);
+  MCSection *FixupSection = OutContext.getELFSection(
+      "bcv_tramp_fixups", ELF::SHT_PROGBITS, Flags, 0, Group);
+
+  OutStreamer->PushSection();
+  OutStreamer->SwitchSection(RangeSection);
+  OutStreamer->EmitValueToAlignment(8);
+  DenseMap<const MachineBasicBlock *, MCSymbol *> Ranges;
+  for (unsigned I = 0, E = Trampolines.size(); I != E; ++I) {
+    MCSymbol *Range = OutContext.createTempSymbol("bcv_range", true);
+    Ranges[Trampolines[I]] = Range;
+    OutStreamer->EmitLabel(Range);
+    OutStreamer->EmitSymbolValue(Trampolines[I]->getSymbol(), 8);
+    OutStreamer->EmitSymbolValue(
+        I + 1 != E ? Trampolines[I + 1]->getSymbol() : TrampolineRegionEnd, 8);
+  }
+
+  auto EmitRange = [&](const MachineBasicBlock *MBB) {
+    if (MCSymbol *Range = Ranges.lookup(MBB))
+      OutStreamer->EmitSymbolValue(Range, 8);
+    else
+      OutStreamer->EmitIntValue(0, 8);
+  };
+
+  OutStreamer->SwitchSection(FixupSection);
+  OutStreamer->EmitValueToAlignment(8);
+  for (const auto &Fixup : TrampolineFixups) {
+    OutStreamer->EmitValue(Fixup.Site, 8);
+    if (Fixup.Base != nullptr)
+      OutStreamer->EmitValue(Fixup.Base, 8);
+    else
+      OutStreamer->EmitIntValue(0, 8);
+    OutStreamer->EmitSymbolValue(Fixup.Target->getSymbol(), 8);
+    EmitRange(Fixup.SiteTrampoline);
+    EmitRange(Fixup.Target);
+    OutStreamer->EmitIntValue(Fixup.Width, 8);
+  }
+  OutStreamer->PopSection();
+
+  Trampolines.clear();
+  TrampolineFixups.clear();
+  TrampolineFixupEnds.clear();
+  TrampolineRegionEnd = nullptr;
+}
+
 void X86AsmPrinter::EmitFunctionBodyStart() {
   if (EmitFPOData) {
     X86TargetStreamer *XTS =
@@ -74,6 +74,25 @@ class LLVM_LIBRARY_VISIBILITY X86AsmPrinter : public AsmPrinter {
 
   StackMapShadowTracker SMShadowTracker;
 
+  // A reference into or out of the trampoline region of a converted function,
+  // see emitTrampolineTable.
+  struct TrampolineFixup {
+    const MCExpr *Site;
+    const MCExpr *Base;
+    const MachineBasicBlock *Target;
+    const MachineBasicBlock *SiteTrampoline;
+    unsigned Width;
+  };
+
+  SmallVector<const MachineBasicBlock *, 32> Trampolines;
+  SmallVector<TrampolineFixup, 32> TrampolineFixups;
+  DenseMap<const MachineInstr *, MCSymbol *> TrampolineFixupEnds;
+  MCSymbol *TrampolineRegionEnd = nullptr;
+
+  void collectTrampolineFixups();
+  void emitTrampolineTable();
+  MCSymbol *getTrampolineSymbol(const MachineBasicBlock &MBB) const;
+
   // All instructions emitted by the X86AsmPrinter should use this helper
   // method.
   //
@@ -116,10 +135,9 @@ public:
 
   void EmitInstruction(const MachineInstr *MI) override;
 
-  void EmitBasicBlockEnd(const MachineBasicBlock &MBB) override {
-    AsmPrinter::EmitBasicBlockEnd(MBB);
-    SMShadowTracker.emitShadowPadding(*OutStreamer, getSubtargetInfo());
-  }
+  void EmitBasicBlockStart(const MachineBasicBlock &MBB) const override;
+
+  void EmitBasicBlockEnd(const MachineBasicBlock &MBB) override;
 
   bool PrintAsmOperand(const MachineInstr *MI, unsigned OpNo,
                        unsigned AsmVariant, const char *ExtraCode,
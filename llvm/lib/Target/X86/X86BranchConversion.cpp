@@ -9,24 +9,46 @@
 
 #include "X86.h"
 #include "X86InstrBuilder.h"
+#include "X86MachineFunctionInfo.h"
 #include "X86Subtarget.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineBlockFrequencyInfo.h"
+#include "llvm/CodeGen/LivePhysRegs.h"
+#include "llvm/CodeGen/LiveRegUnits.h"
+#include "llvm/CodeGen/MachineBranchProbabilityInfo.h"
 #include "llvm/CodeGen/MachineFunction.h"
 #include "llvm/CodeGen/MachineInstrBuilder.h"
+#include "llvm/CodeGen/MachineJumpTableInfo.h"
+#include "llvm/CodeGen/MachineLoopInfo.h"
+#include "llvm/CodeGen/MachineOptimizationRemarkEmitter.h"
 #include "llvm/CodeGen/MachineModuleInfo.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
 #include "llvm/CodeGen/Passes.h"
 #include "llvm/CodeGen/TargetPassConfig.h"
 #include "llvm/CodeGen/TargetInstrInfo.h"
 #include "llvm/CodeGen/TargetRegisterInfo.h"
+#include "llvm/CodeGen/TargetSchedule.h"
+#include "llvm/IR/CFG.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DiagnosticInfo.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Module.h"
+#include "llvm/Support/Allocator.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/MC/MCInstrInfo.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/CodeGen/AsmPrinter.h"
-#include <list>
+#include <algorithm>
 
 #define KNRM  "\x1B[0m"
 #define KRED  "\x1B[31m"
@@ -56,27 +78,236 @@ using namespace llvm;
 
 #define DEBUG_TYPE "x86-branch-conversion"
 
+STATISTIC(NumFunctionsConverted, "Number of functions converted");
+STATISTIC(NumCondBranchesConverted, "Number of conditional branches converted");
+STATISTIC(NumCondBranchesKept, "Number of non-secret conditional branches kept");
+STATISTIC(NumCondBranchesFused, "Number of conditional branches fused into the branch of their chain");
+STATISTIC(NumCondBranchesSetcc, "Number of conditional branches converted with SETcc and a scaled LEA");
+STATISTIC(NumJumpsConverted, "Number of unconditional jumps converted");
+STATISTIC(NumIndirectJumpsConverted, "Number of indirect jumps converted");
+STATISTIC(NumFallThroughsConverted, "Number of fall-through blocks routed through the trampoline");
+STATISTIC(NumTrampolineBlocks, "Number of trampoline blocks created");
+STATISTIC(NumSkipHops, "Number of skip lane hops inserted");
+STATISTIC(NumDispatchers, "Number of indirect jumps shared by the fake blocks of a dispatch region");
+STATISTIC(NumSharedPaddings, "Number of padded trampolines shared by several skip lanes");
+STATISTIC(NumBytesAdded, "Estimated code size of the inserted instructions in bytes");
+
+// Scratch register candidates, caller-saved registers first, they are free more often and never need to be saved
+static constexpr const MCPhysReg scratchCandidates[] = {
+    X86::R11, X86::R10, X86::R9, X86::R8, X86::RAX, X86::RCX, X86::RDX, X86::RSI, X86::RDI,
+    X86::R15, X86::R14, X86::R13, X86::R12, X86::RBX};
+
+// Defined in X86RegisterInfo.cpp, which reserves the fixed registers when set
+extern cl::opt<bool> BranchConversionReserveRegs;
+// Defined in X86TargetMachine.cpp, the defaults of the pass instances it creates
+extern cl::opt<bool> EnableBranchConversion;
+extern cl::opt<bool> BranchConversionSecretOnly;
+// Defined in X86TargetMachine.cpp, implies a trampoline section shared by all functions
+extern cl::opt<bool> BranchConversionWholeProgramLayout;
+
 namespace {
 struct blockLane {
   MachineBasicBlock *currentMBB;
   MachineBasicBlock *DestMBB;
   bool taken;
+  uint64_t freq; // estimated execution frequency of the path using this lane
+  DebugLoc loc;  // the branch that led onto the lane, carried by the jumps and hops along it
 
-  blockLane(MachineBasicBlock *a, MachineBasicBlock *b, bool c) {
+  blockLane(MachineBasicBlock *a, MachineBasicBlock *b, bool c, uint64_t f, const DebugLoc &l) {
     currentMBB = a;
     DestMBB = b;
     taken = c;
+    freq = f;
+    loc = l;
   }
 };
 
+// Per-function counts, reported through the statistics and the optimization remark of the function
+struct conversionStats {
+  unsigned condBranches = 0;
+  unsigned keptCondBranches = 0;
+  unsigned setccCondBranches = 0;
+  unsigned fusedCondBranches = 0;
+  unsigned jumps = 0;
+  unsigned indirectJumps = 0;
+  unsigned fallThroughs = 0;
+  unsigned trampolines = 0;
+  unsigned skipHops = 0;
+  unsigned sharedPaddings = 0;
+  unsigned dispatchers = 0;
+  uint64_t bytes = 0;
+};
+
+// Estimated cost of executing code, per invocation of the function
+struct executionCost {
+  double cycles = 0; // sum of instruction latencies, i.e., assuming no overlap
+  double uops = 0;
+};
+
+enum SkipLaneMode {
+  SL_Chain,   // skip lanes hop through the fake block of every skipped block
+  SL_Collapse // blocks without a branch fall through directly, skip lanes only hop over branch sites
+};
+
+enum PaddingModel {
+  PM_Count,  // one instruction per instruction of the skipped block
+  PM_Latency // a dependency chain taking as many cycles as the skipped block
+};
+
+enum CondLowering {
+  CL_Cmov,  // LEA both trampolines and CMOV between them
+  CL_Setcc, // SETcc an index and LEA the trampoline at index * 8 behind the fallthrough one
+  CL_Auto   // whichever of the two the scheduling model estimates to be cheaper, per function
+};
+
+enum TrampolineLayout {
+  TL_Creation, // reverse creation order, i.e., plain MF.push_front
+  TL_Profile   // hottest trampolines packed together next to the function body
+};
+
 static cl::opt<bool> EnableBBDummyInstr("x86-bc-dummy-instr",
                                         cl::desc("Use dummy instruction in skip-trampolines."),
                                         cl::init(false), cl::Hidden);
 
+static cl::opt<PaddingModel> DummyPadding(
+    "x86-bc-dummy-padding",
+    cl::desc("How much padding -x86-bc-dummy-instr puts into skip trampolines."),
+    cl::init(PM_Count), cl::Hidden,
+    cl::values(clEnumValN(PM_Count, "count",
+                          "One instruction per instruction of the skipped block"),
+               clEnumValN(PM_Latency, "latency",
+                          "The fewest bytes of dependent instructions that take "
+                          "as many cycles as the skipped block, according to "
+                          "the scheduling model")));
+
+static cl::opt<bool> SharePadding(
+    "x86-bc-share-padding",
+    cl::desc("Let the skip lanes hopping over the same block share one padded "
+             "trampoline instead of each carrying its own copy of the padding "
+             "(with -x86-bc-dummy-padding=count)."),
+    cl::init(false), cl::Hidden);
+
+static cl::opt<SkipLaneMode> SkipLanes(
+    "x86-bc-skip-lanes",
+    cl::desc("How skip lanes are routed over blocks that are not executed."),
+    cl::init(SL_Chain), cl::Hidden,
+    cl::values(clEnumValN(SL_Chain, "chain",
+                          "Hop through the fake block of every skipped block"),
+               clEnumValN(SL_Collapse, "collapse",
+                          "Let blocks without branches fall through and only "
+                          "hop over blocks that contain a branch site")));
+
+static cl::opt<CondLowering> CondBranchLowering(
+    "x86-bc-cond-lowering",
+    cl::desc("How converted conditional branches select their trampoline."),
+    cl::init(CL_Cmov), cl::Hidden,
+    cl::values(clEnumValN(CL_Cmov, "cmov",
+                          "Load both trampoline addresses and CMOV between them"),
+               clEnumValN(CL_Setcc, "setcc",
+                          "SETcc an index and scale it into the address of "
+                          "the adjacent taken trampoline"),
+               clEnumValN(CL_Auto, "auto",
+                          "Pick the variant with fewer micro-ops, then fewer "
+                          "bytes, according to the scheduling model")));
+
+static cl::opt<TrampolineLayout> TrampolineLayoutMode(
+    "x86-bc-trampoline-layout",
+    cl::desc("Ordering of trampoline blocks created by branch conversion."),
+    cl::init(TL_Creation), cl::Hidden,
+    cl::values(clEnumValN(TL_Creation, "creation",
+                          "Place trampolines in reverse creation order"),
+               clEnumValN(TL_Profile, "profile",
+                          "Order trampolines by block frequency and branch "
+                          "probability (uses PGO data when present)")));
+
+static cl::opt<std::string> TrampolineSectionName(
+    "x86-bc-trampoline-section",
+    cl::desc("Emit trampoline blocks into this ELF section instead of in "
+             "front of the function body."),
+    cl::init(""), cl::Hidden);
+
+static cl::opt<bool> TrampolineSectionPerFunction(
+    "x86-bc-trampoline-section-per-function",
+    cl::desc("Use a separate trampoline section per function, named "
+             "<section>.<function>."),
+    cl::init(false), cl::Hidden);
+
+static cl::opt<unsigned> TrampolineAlignment(
+    "x86-bc-trampoline-align",
+    cl::desc("Alignment in bytes of the trampolines of each function in the "
+             "trampoline section."),
+    cl::init(16), cl::Hidden);
+
+static cl::opt<bool> TrampolineTable(
+    "x86-bc-trampoline-table",
+    cl::desc("Describe the trampoline blocks and the references to them in "
+             "the bcv_tramp_ranges and bcv_tramp_fixups sections, so that the "
+             "trampolines can be permuted at run time (implies the trampoline "
+             "section)."),
+    cl::init(false), cl::Hidden);
+
+static cl::opt<bool> TrampolineSymbols(
+    "x86-bc-trampoline-symbols",
+    cl::desc("Give every trampoline block a local function symbol "
+             "<function>.bcv.tramp.<N>, so that profilers attribute its "
+             "samples (ELF only, not in pre-layout mode)."),
+    cl::init(false), cl::Hidden);
+
+static cl::opt<bool> LocalLoopTrampolines(
+    "x86-bc-local-loop-trampolines",
+    cl::desc("Place the trampolines of loop back-edges right after the "
+             "latch instead of in the trampoline region."),
+    cl::init(false), cl::Hidden);
+
+static cl::opt<unsigned> DispatchRegion(
+    "x86-bc-dispatch-region",
+    cl::desc("Let up to this many consecutive converted blocks share one "
+             "indirect jump, which their fake blocks reach through a direct "
+             "jump (0 = one indirect jump per block)."),
+    cl::init(0), cl::Hidden);
+
+static cl::opt<bool> ShortJumps(
+    "x86-bc-short-jumps",
+    cl::desc("Emit trampoline, lane and entry jumps in their short form and "
+             "let the assembler relax those whose target is out of range. The "
+             "two lanes of a branch may then differ in size."),
+    cl::init(false), cl::Hidden);
+
+static cl::opt<bool> FuseChains(
+    "x86-bc-fuse-chains",
+    cl::desc("Fuse chains of conditional branches to the same target, e.g., "
+             "from short-circuit conditions, into a single converted branch."),
+    cl::init(false), cl::Hidden);
+
+static cl::opt<bool> OverheadReport(
+    "x86-bc-overhead-report",
+    cl::desc("Estimate the overhead of branch conversion with the scheduling "
+             "model and report it as an optimization remark."),
+    cl::init(false), cl::Hidden);
+
+static cl::opt<unsigned> OverheadBudget(
+    "x86-bc-overhead-budget",
+    cl::desc("Warn about functions whose estimated cycles grow by more than "
+             "this percentage (implies -x86-bc-overhead-report, 0 = no budget)."),
+    cl::init(0), cl::Hidden);
+
 class X86BranchConversion : public MachineFunctionPass {
 private:
   static unsigned int getCorrespondingMovOpcode(MachineInstr &MI);
 
+  bool shouldConvert(const MachineFunction &MF) const;
+
+  bool isSecretBranch(const MachineBasicBlock &MBB, const MachineBasicBlock *dstMBB) const;
+
+  static bool isSiteless(const MachineBasicBlock &MBB, const MachineBasicBlock *fallThrough,
+                         const MachineBasicBlock *next);
+
+  static DebugLoc getBranchLoc(const MachineBasicBlock &MBB);
+
+  bool keepConditionalBranch(MachineFunction &MF, MachineBasicBlock &MBB,
+                             MachineInstrBundleIterator<MachineInstr, false> iter,
+                             struct blockLane *takenLane, uint64_t fallThroughFreq);
+
   bool replaceUnconditionalJump(MachineFunction &MF, MachineBasicBlock &MBB,
                                 MachineInstrBundleIterator <MachineInstr> &iter,
                                 MachineBasicBlock *fallThrough,
@@ -87,6 +318,24 @@ private:
                                 MachineBasicBlock *fallThrough,
                                 struct blockLane *takenLane);
 
+  void fuseConditionChains(MachineFunction &MF);
+
+  bool fuseConditionChain(ArrayRef<MachineBasicBlock *> chain, MachineBasicBlock *target,
+                          MachineBasicBlock *exit);
+
+  MachineBasicBlock *getChainTarget(MachineBasicBlock &MBB, MachineBasicBlock *&exit) const;
+
+  static bool canSpeculate(const MachineBasicBlock &MBB);
+
+  bool replaceConditionalBranchWithSetcc(MachineFunction &MF, MachineBasicBlock &MBB,
+                                         MachineInstrBundleIterator<MachineInstr, false> iter,
+                                         MachineBasicBlock *dstMBB, struct blockLane *takenLane,
+                                         uint64_t takenFreq, uint64_t fallThroughFreq);
+
+  bool prefersSetccLowering() const;
+
+  unsigned getOpcodeMicroOps(unsigned opcode) const;
+
   bool replaceIndirectJump(MachineFunction &MF, MachineBasicBlock &MBB,
                            MachineInstrBundleIterator <MachineInstr> &iter,
                            MachineBasicBlock *fallThrough,
@@ -97,14 +346,84 @@ private:
                             MachineBasicBlock *fallThrough,
                             struct blockLane *takenLane);
 
-  void addDummyInstructions(MachineBasicBlock *realBlock, MachineBasicBlock *trampolineBlock);
+  void redirectJumpTables(MachineFunction &MF);
+
+  void addDummyInstructions(MachineBasicBlock *realBlock, MachineBasicBlock *trampolineBlock,
+                            const DebugLoc &DL);
+
+  void addFakeBlockJump(MachineFunction &MF, MachineBasicBlock *fakeBlock);
+
+  MachineBasicBlock *createSharedPadding(MachineBasicBlock &MBB, MachineFunction &MF,
+                                         MachineBasicBlock *fakeBlock);
+
+  void addLatencyPadding(MachineBasicBlock *realBlock, MachineBasicBlock *trampolineBlock, const DebugLoc &DL);
+
+  unsigned estimateBlockCycles(const MachineBasicBlock &MBB) const;
+
+  static unsigned paddingSize(unsigned opcode, unsigned reg);
+
+  static unsigned estimateSize(const MachineInstr &MI);
+
+  inline const MachineInstrBuilder &countBytes(const MachineInstrBuilder &MIB);
+
+  void reportStats(MachineFunction &MF, MachineBasicBlock &entry);
+
+  executionCost estimateCost(const MachineFunction &MF, bool converted) const;
+
+  void reportOverhead(MachineFunction &MF, MachineBasicBlock &entry);
+
+  // Scratch register selection
+  void collectLiveOuts(MachineFunction &MF);
+
+  void selectScratchRegs(MachineBasicBlock &MBB);
+
+  void requireTmpReg(const MachineBasicBlock &MBB) const;
 
   MachineBasicBlock *CreateNewBBonTrampoline(MachineBasicBlock &MBB, MachineFunction &MF,
-                                             MachineBasicBlock *destOnCode);
+                                             MachineBasicBlock *destOnCode, uint64_t freq = 0,
+                                             MachineBasicBlock *after = nullptr);
+
+  MachineBasicBlock *getLoopTrampolinePos(MachineBasicBlock &MBB, const MachineBasicBlock *dstMBB) const;
+
+  struct blockLane *addBBtoBlockLane(MachineBasicBlock *MBB, MachineBasicBlock *DestMBB, bool taken,
+                                     uint64_t freq = 0);
+
+  inline void updateLane(struct blockLane *lane, MachineBasicBlock *a, MachineBasicBlock *b, bool c,
+                         uint64_t freq = 0);
+
+  struct blockLane *joinSkipLane(MachineBasicBlock *DestMBB, uint64_t freq);
+
+  inline bool isProcessed(const MachineBasicBlock *MBB) const;
+
+  // Profile helpers, all frequencies are zero unless tracksFrequencies
+  bool tracksFrequencies() const;
+
+  static bool reportsOverhead();
+
+  void collectProfile(MachineFunction &MF);
+
+  uint64_t getBlockFreq(const MachineBasicBlock *MBB) const;
+
+  uint64_t getEdgeFreq(const MachineBasicBlock *src, const MachineBasicBlock *dst) const;
+
+  void layoutTrampolines(MachineFunction &MF, MachineBasicBlock &entry);
+
+  bool placeTrampolinesInSection(MachineFunction &MF, MachineBasicBlock &entry);
+
+  void addTrampolineTable(MachineFunction &MF, MachineBasicBlock &entry);
+
+  // Short jumps are relaxed by the assembler, pre-layout mode needs them for analyzeBranch
+  unsigned getJumpOpcode() const { return preLayout || ShortJumps ? X86::JMP_1 : X86::JMP_4; }
+
+  // Pre-layout mode, where the CFG has to stay exact for block placement
 
-  struct blockLane *addBBtoBlockLane(MachineBasicBlock *MBB, MachineBasicBlock *DestMBB, bool taken);
+  void addFakeBlockSuccessor(MachineBasicBlock *succ, uint64_t freq);
 
-  inline void updateLane(struct blockLane *lane, MachineBasicBlock *a, MachineBasicBlock *b, bool c);
+  void routeThroughFakeBlock(MachineBasicBlock &MBB, bool transferSuccs);
+
+  void finishPreLayout(MachineFunction &MF, MachineBasicBlock &entry);
+
+  void updateLiveIns();
 
   // Debug Functions
   static std::string getOperandType(MachineOperand &op);
@@ -120,58 +439,217 @@ private:
 public:
   static char ID;
 
-  X86BranchConversion() : MachineFunctionPass(ID) {}
+  X86BranchConversion(bool convertByDefault = false, bool secretOnly = false, bool preLayout = false)
+      : MachineFunctionPass(ID), convertByDefault(convertByDefault), secretOnly(secretOnly),
+        preLayout(preLayout) {}
 
   StringRef getPassName() const override { return "X86 Branch Conversion"; }
 
-  bool doInitialization(Module &M) override;
+  void getAnalysisUsage(AnalysisUsage &AU) const override;
 
   bool runOnMachineFunction(MachineFunction &F) override;
 
 private:
-  static constexpr const unsigned targetRegOpcode = X86::R15;
-  static constexpr const unsigned tmpReg = X86::R13; // temporary register used by conditional move
-  static constexpr const unsigned tmpReg8 = X86::R13B; // temporary register used by conditional move
+  // Whether functions without an explicit attribute are converted, may be overridden by the module flag
+  bool convertByDefault;
+  // Only convert conditional branches marked by the secret dependence analysis
+  bool secretOnly;
+  // Running before block placement, see finishPreLayout
+  bool preLayout;
+
+  // Scratch registers of the block being converted, see selectScratchRegs
+  unsigned targetReg = X86::NoRegister; // holds the trampoline address jumped to by the fake block
+  unsigned tmpReg = X86::NoRegister;    // temporary register used by conditional move
+  // Lower secret conditional branches with SETcc instead of CMOV, see prefersSetccLowering
+  bool setccLowering = false;
+  // Fake block of the block being converted, if it has one
+  MachineBasicBlock *currentFakeBlock = nullptr;
+  // Location of the branch being converted, carried by everything inserted for it (see getBranchLoc)
+  DebugLoc branchLoc;
+  // The shared indirect jump of the current dispatch region per target register, and how many more
+  // fake blocks may still use it
+  DenseMap<unsigned, std::pair<MachineBasicBlock *, unsigned>> dispatchers;
 
   const TargetMachine *TM;
   const X86Subtarget *STI;
   const X86InstrInfo *TII;
-
-  std::list<struct blockLane *> *takenBlocks;
-  std::set<MachineBasicBlock *> *processedMBBs;
+  const TargetRegisterInfo *TRI;
+  const MachineRegisterInfo *MRI;
+  MachineOptimizationRemarkEmitter *ORE;
+  const MachineLoopInfo *MLI;
+
+  conversionStats stats;
+
+  TargetSchedModel schedModel;
+  executionCost costBefore;
+  // Estimated cycles of each block skipped by a padded lane, see addLatencyPadding
+  DenseMap<const MachineBasicBlock *, unsigned> blockCycles;
+
+  // Registers live out of each original block, snapshotted before trampolines are added as successors
+  DenseMap<const MachineBasicBlock *, BitVector> liveOutUnits;
+
+  // Lane bookkeeping, all lanes are allocated from the arena and released together after each function
+  BumpPtrAllocator laneAllocator;
+  SmallVector<struct blockLane *, 16> lanes;
+  // The single skip lane heading to each destination, all other sources join it instead of growing a chain
+  DenseMap<const MachineBasicBlock *, struct blockLane *> skipLaneByDest;
+  // Indexed by block number, grows as new blocks get numbered
+  BitVector processedMBBs;
+
+  // Frequencies of the original blocks and CFG edges, snapshotted before we start modifying the CFG
+  DenseMap<const MachineBasicBlock *, uint64_t> blockFreqs;
+  DenseMap<std::pair<const MachineBasicBlock *, const MachineBasicBlock *>, uint64_t> edgeFreqs;
+  // Estimated execution frequency of each trampoline and fake block we created
+  DenseMap<const MachineBasicBlock *, uint64_t> trampolineFreqs;
+  uint64_t entryFreq = 0;
+
+  // All blocks we created, and the frequencies of the edges leaving the fake blocks (pre-layout mode)
+  SmallVector<MachineBasicBlock *, 32> fakeBlocks;
+  SmallVector<MachineBasicBlock *, 64> createdBlocks;
+  DenseMap<std::pair<MachineBasicBlock *, MachineBasicBlock *>, uint64_t> fakeEdgeFreqs;
 };
 
 } // end anonymous namespace
 
-FunctionPass *llvm::createX86BranchConversionPass() {
-  return new X86BranchConversion();
+FunctionPass *llvm::createX86BranchConversionPass(bool ConvertByDefault, bool SecretOnly, bool PreLayout) {
+  return new X86BranchConversion(ConvertByDefault, SecretOnly, PreLayout);
+}
+
+bool llvm::isBranchConversionEnabled(const Function &F, bool ConvertByDefault) {
+  if (F.hasFnAttribute("no-branch-shadow-protect"))
+    return false;
+  if (F.hasFnAttribute("branch-shadow-protect") || ConvertByDefault)
+    return true;
+
+  // A module flag can turn on conversion for the whole module, e.g., when set by the frontend
+  auto *flag = mdconst::extract_or_null<ConstantInt>(F.getParent()->getModuleFlag("branch-shadow-protect"));
+  return flag != nullptr && !flag->isZero();
+}
+
+bool llvm::isBranchConversionEnabled(const Function &F) {
+  return isBranchConversionEnabled(F, EnableBranchConversion);
+}
+
+// The pass converts anything it cannot map back to an IR terminator, see X86BranchConversion::isSecretBranch
+static bool isBranchConverted(const Function &F, const Instruction *term) {
+  if (!isBranchConversionEnabled(F))
+    return false;
+  return !BranchConversionSecretOnly || term == nullptr || term->getMetadata("bcv.secret") != nullptr;
+}
+
+bool llvm::isBranchConverted(const MachineBasicBlock &MBB) {
+  const BasicBlock *BB = MBB.getBasicBlock();
+  return ::isBranchConverted(MBB.getParent()->getFunction(), BB != nullptr ? BB->getTerminator() : nullptr);
+}
+
+bool llvm::isBranchConverted(const Instruction &Term) {
+  return ::isBranchConverted(*Term.getFunction(), &Term);
 }
 
 char X86BranchConversion::ID = 0;
 
-bool X86BranchConversion::doInitialization(Module &M) {
-  return false;
+/**
+ * @brief check whether the function should be converted
+ *
+ * The per-function "branch-shadow-protect" and "no-branch-shadow-protect" attributes take precedence
+ * over the module-wide default. Earlier passes ask the same through isBranchConversionEnabled.
+ *
+ * @param MF The machine function to check
+ * @return true if the branches of MF should be converted
+ */
+bool X86BranchConversion::shouldConvert(const MachineFunction &MF) const {
+  return isBranchConversionEnabled(MF.getFunction(), convertByDefault);
+}
+
+/**
+ * @brief check whether a conditional branch needs conversion in secret-only mode
+ *
+ * The secret dependence analysis marks the IR terminators, so we map the branch back to its IR block.
+ * Anything we cannot map is conservatively converted. This includes branches whose target is not a
+ * successor of the IR block, as they were moved here from another block, e.g., by tail duplication.
+ *
+ * @param MBB The block containing the conditional branch
+ * @param dstMBB The target of the conditional branch
+ * @return true if the branch must be converted
+ */
+bool X86BranchConversion::isSecretBranch(const MachineBasicBlock &MBB, const MachineBasicBlock *dstMBB) const {
+  if (!secretOnly)
+    return true;
+
+  const BasicBlock *BB = MBB.getBasicBlock();
+  if (BB == nullptr || dstMBB == nullptr || dstMBB->getBasicBlock() == nullptr)
+    return true;
+
+  auto *term = BB->getTerminator();
+  if (term == nullptr || term->getMetadata("bcv.secret") != nullptr)
+    return true;
+
+  // Branches within the IR block (e.g., lowered selects) are covered by the mark of the block
+  const BasicBlock *dstBB = dstMBB->getBasicBlock();
+  if (dstBB == BB)
+    return false;
+  for (const auto *succ : successors(BB))
+    if (succ == dstBB)
+      return false;
+
+  return true;
+}
+
+void X86BranchConversion::getAnalysisUsage(AnalysisUsage &AU) const {
+  if (LocalLoopTrampolines)
+    AU.addRequired<MachineLoopInfo>();
+  if (tracksFrequencies())
+    AU.addRequired<MachineBlockFrequencyInfo>();
+  if (tracksFrequencies() || FuseChains)
+    AU.addRequired<MachineBranchProbabilityInfo>();
+  MachineFunctionPass::getAnalysisUsage(AU);
 }
 
 bool X86BranchConversion::runOnMachineFunction(MachineFunction &MF) {
   DEBUG(dbgs() << getPassName() << '\n');
 
+  if (!shouldConvert(MF))
+    return false;
+
   TM = &MF.getTarget();
   STI = &MF.getSubtarget<X86Subtarget>();
   TII = STI->getInstrInfo();
+  TRI = STI->getRegisterInfo();
+  MRI = &MF.getRegInfo();
+  // Not a required analysis, so that the functions we leave alone do not pay for it
+  MachineOptimizationRemarkEmitter localORE(
+      MF, tracksFrequencies() ? &getAnalysis<MachineBlockFrequencyInfo>() : nullptr);
+  ORE = &localORE;
+  // Only queried for original blocks, so it stays valid while we add trampolines
+  MLI = LocalLoopTrampolines ? &getAnalysis<MachineLoopInfo>() : nullptr;
+  stats = conversionStats();
+
+  if (FuseChains)
+    fuseConditionChains(MF);
+
+  collectLiveOuts(MF);
 
-  takenBlocks = new std::list<struct blockLane *>();
-  processedMBBs = new std::set<MachineBasicBlock *>();
+  processedMBBs.resize(MF.getNumBlockIDs());
+
+  collectProfile(MF);
+
+  schedModel.init(STI->getSchedModel(), STI, TII);
+  setccLowering = prefersSetccLowering();
+  if (reportsOverhead())
+    costBefore = estimateCost(MF, false);
 
   auto &entry = MF.front(); // TMP: store this so we can jump over trampolines
 
   BC_DEBUG(dump_function(MF));
 
   // Inset a default startup blockLane
-  addBBtoBlockLane(nullptr, nullptr, true);
+  addBBtoBlockLane(nullptr, nullptr, true, getBlockFreq(&entry));
+
+  // Creates trampoline blocks in front of the entry, so start iterating from the entry instead of MF.begin()
+  redirectJumpTables(MF);
 
   // Use manual iterator to better control iteration while inserting new stuff
-  auto iMBB = MF.begin();
+  auto iMBB = entry.getIterator();
   while (iMBB != MF.end()) {
     auto &MBB = *iMBB;
     ++iMBB; // Move iterator forward
@@ -184,33 +662,59 @@ bool X86BranchConversion::runOnMachineFunction(MachineFunction &MF) {
 #endif
 
     // This block might jump to itself, so immediately mark it as processed to handle this properly
-    processedMBBs->insert(&MBB);
+    if ((unsigned)MBB.getNumber() >= processedMBBs.size())
+      processedMBBs.resize(MF.getNumBlockIDs());
+    processedMBBs.set(MBB.getNumber());
 
     MachineBasicBlock *originalFallThrough = MBB.getFallThrough();
+    branchLoc = getBranchLoc(MBB);
+
+    // Must happen before the skip lanes are hopped over this block, as the hops use the target register
+    selectScratchRegs(MBB);
 
     // Insert new block, unless iterator is at tend
     MachineBasicBlock *fakeBlock = nullptr;
-    if (!(iMBB == MF.end() && MBB.isReturnBlock())) {
+    currentFakeBlock = nullptr;
+    bool siteless = SkipLanes == SL_Collapse &&
+                    isSiteless(MBB, originalFallThrough, iMBB == MF.end() ? nullptr : &*iMBB);
+    if (!(iMBB == MF.end() && MBB.isReturnBlock()) && !siteless) {
       // Only if this is the last block AND has a return can we omit the jump-block
       fakeBlock = MF.CreateMachineBasicBlock();
       MF.insert(iMBB, fakeBlock); // Insert before next element (between MBB and iMBB)
-      BuildMI(fakeBlock, DebugLoc(), TII->get(X86::JMP64r), targetRegOpcode);
+      addFakeBlockJump(MF, fakeBlock);
+      // Reached by the taken path of MBB, the skip lanes add their frequency when hopping
+      if (tracksFrequencies())
+        trampolineFreqs[fakeBlock] = getBlockFreq(&MBB);
+      fakeBlocks.push_back(fakeBlock);
+      createdBlocks.push_back(fakeBlock);
+      currentFakeBlock = fakeBlock;
     }
 
+    // Skip lanes hopping over MBB may share its padding, they continue to the fake block from there
+    MachineBasicBlock *padBlock = nullptr;
+    if (fakeBlock != nullptr)
+      padBlock = createSharedPadding(MBB, MF, fakeBlock);
+
     // We only need one lane for taking, so we can terminate any extra ones
     struct blockLane *takenLane = nullptr;
 
-    // We also always need to update incoming blocks, so lets do that here also
-    LANE_DEBUG(errs() << "!!! updating " << takenBlocks->size() << " lanes\n");
-    for (auto laneIterator = takenBlocks->begin(); laneIterator != takenBlocks->end(); laneIterator++) {
-      auto lane = *laneIterator;
+    // Any skip lane heading here ends at this block
+    skipLaneByDest.erase(&MBB);
+
+    // We also always need to update incoming blocks, so lets do that here also. Surviving lanes are
+    // compacted to the front of the vector as we go.
+    LANE_DEBUG(errs() << "!!! updating " << lanes.size() << " lanes\n");
+    unsigned liveLanes = 0;
+    for (unsigned laneIdx = 0, numLanes = lanes.size(); laneIdx != numLanes; ++laneIdx) {
+      auto lane = lanes[laneIdx];
+      bool keepLane = true;
 
       if (lane->taken || lane->DestMBB == &MBB) {
         if (lane->currentMBB != nullptr) {
           // Put in the jump from the previous trampoline to this MBB (e.g., zBlockN -> BlockN);
           LANE_DEBUG(errs() << "!!! updating lane to ");
           LANE_DEBUG(errs().write_escaped(MBB.getName()) << "\n");
-          BuildMI(lane->currentMBB, DebugLoc(), TII->get(X86::JMP_4)).addMBB(&MBB);
+          countBytes(BuildMI(lane->currentMBB, lane->loc, TII->get(getJumpOpcode())).addMBB(&MBB));
           lane->currentMBB->addSuccessor(&MBB);
         }
 
@@ -219,43 +723,57 @@ bool X86BranchConversion::runOnMachineFunction(MachineFunction &MF) {
           takenLane = lane;
         } else {
           // We can remove this lane if we already have one that is going to update the taken path
-          laneIterator = takenBlocks->erase(laneIterator); // Moves iterator forward!
-          laneIterator--;
+          keepLane = false;
           LANE_DEBUG(errs() << "!!! removing duplicate lane\n");
         }
       } else if (lane->currentMBB != nullptr) {
         LANE_DEBUG(errs() << "!!! updating skip lane\n");
-        assert(fakeBlock != nullptr && "assuming this will never happen for last block");
+        assert((fakeBlock != nullptr || siteless) && "assuming this will never happen for last block");
 
-        // FIXME: we could remove duplicate lanes with the same destination, but should work as is.
+        // A block without branch sites is invisible to branch shadowing, so the lane can skip it for free
+        if (siteless && EnableBBDummyInstr)
+          addDummyInstructions(&MBB, lane->currentMBB, lane->loc);
 
-        if (fakeBlock != nullptr) {
-          auto nextZBlock = CreateNewBBonTrampoline(MBB, MF, nullptr);
+        // Sources sharing a destination join the same lane when it is created (see joinSkipLane)
+        assert(skipLaneByDest.lookup(lane->DestMBB) == lane && "duplicate skip lane for destination");
 
-          if (EnableBBDummyInstr)
-            addDummyInstructions(&MBB, lane->currentMBB);
-
-          //BuildMI(lane->currentMBB, DebugLoc(), TII->get(X86::MOV64ri), targetRegOpcode).addMBB(nextZBlock);
-          BuildMI(lane->currentMBB, DebugLoc(), TII->get(X86::LEA64r), targetRegOpcode)
-              .addReg(X86::RIP)
-              .addImm(0)
-              .addReg(0)
-              .addMBB(nextZBlock)
-              .addReg(0);
-          BuildMI(lane->currentMBB, DebugLoc(), TII->get(X86::JMP_4)).addMBB(fakeBlock);
-          lane->currentMBB->addSuccessor(fakeBlock);
+        if (fakeBlock != nullptr) {
+          auto nextZBlock = CreateNewBBonTrampoline(MBB, MF, nullptr, lane->freq);
+
+          if (EnableBBDummyInstr && padBlock == nullptr)
+            addDummyInstructions(&MBB, lane->currentMBB, lane->loc);
+
+          //BuildMI(lane->currentMBB, DebugLoc(), TII->get(X86::MOV64ri), targetReg).addMBB(nextZBlock);
+          countBytes(BuildMI(lane->currentMBB, lane->loc, TII->get(X86::LEA64r), targetReg)
+                         .addReg(X86::RIP)
+                         .addImm(0)
+                         .addReg(0)
+                         .addMBB(nextZBlock)
+                         .addReg(0));
+          auto hopBlock = padBlock != nullptr ? padBlock : fakeBlock;
+          countBytes(BuildMI(lane->currentMBB, lane->loc, TII->get(getJumpOpcode())).addMBB(hopBlock));
+          lane->currentMBB->addSuccessor(hopBlock);
+          ++stats.skipHops;
+          if (tracksFrequencies()) {
+            trampolineFreqs[fakeBlock] += lane->freq;
+            if (padBlock != nullptr)
+              trampolineFreqs[padBlock] += lane->freq;
+          }
 
           // Update our lane to point to the zSkipMBB
           lane->currentMBB = nextZBlock;
         }
       } else {
         // This lane is dead, let's remove it
-        laneIterator = takenBlocks->erase(laneIterator); // Moves iterator forward!
-        laneIterator--;
+        keepLane = false;
         LANE_DEBUG(errs() << "!!! removing dead lane\n");
       }
+
+      if (keepLane)
+        lanes[liveLanes++] = lane;
     }
-    LANE_DEBUG(errs() << "!!! " << takenBlocks->size() << " lanes left\n");
+    lanes.resize(liveLanes);
+    LANE_DEBUG(errs() << "!!! " << lanes.size() << " lanes left\n");
 
     auto pos = --(MBB.end()); // get iterator to last instruction
 
@@ -263,10 +781,15 @@ bool X86BranchConversion::runOnMachineFunction(MachineFunction &MF) {
       // We have no taken lane, this could be due to an indirect jump that lands directly into this
       // block. So lets just create a empty lane to go forward.
       LANE_DEBUG(errs() << "!!! found a non-taken lane, adding new lane\n");
-      takenLane = addBBtoBlockLane(nullptr, nullptr, true);
+      takenLane = addBBtoBlockLane(nullptr, nullptr, true, getBlockFreq(&MBB));
     }
 
     if (pos == MBB.end()) {
+      if (siteless) {
+        // Nothing to convert, the taken lane simply falls through into the next block
+        updateLane(takenLane, nullptr, nullptr, true, getBlockFreq(&MBB));
+        continue;
+      }
       errs() << "\t\t\t!!!!!!!!!!!!!!!!!!!!!!WARNING: We seem to have an empty block: ";
       continue;
     }
@@ -282,8 +805,19 @@ bool X86BranchConversion::runOnMachineFunction(MachineFunction &MF) {
         // Create new MBB and put jmp in there
         auto newBlock = MF.CreateMachineBasicBlock();
         MF.insert(iMBB, newBlock); // Insert before next element (between MBB and iMBB)
-        BuildMI(newBlock, DebugLoc(), TII->get(pos->getOpcode())).addMBB(pos->getOperand(0).getMBB());
+        // The split block executes whenever the conditional branch falls through
+        if (tracksFrequencies()) {
+          uint64_t takenFreq = getEdgeFreq(&MBB, tmp_iter->getOperand(0).getMBB());
+          uint64_t freq = getBlockFreq(&MBB);
+          blockFreqs[newBlock] = freq > takenFreq ? freq - takenFreq : 0;
+        }
+        BuildMI(newBlock, pos->getDebugLoc(), TII->get(pos->getOpcode())).addMBB(pos->getOperand(0).getMBB());
+        // Conservatively live out whatever the original block had live out
+        if (!BranchConversionReserveRegs)
+          liveOutUnits[newBlock] = liveOutUnits.lookup(&MBB);
+        newBlock->addSuccessor(pos->getOperand(0).getMBB());
         MBB.addSuccessor(newBlock);
+        createdBlocks.push_back(newBlock);
         // Move iMBB back so we proces the new block
         iMBB--;
         // remove jmp from old block and restore pos
@@ -309,21 +843,314 @@ bool X86BranchConversion::runOnMachineFunction(MachineFunction &MF) {
     }
   }
 
-  MachineBasicBlock *newBlock = MF.CreateMachineBasicBlock();
-  MF.push_front(newBlock);
-  BuildMI(newBlock, DebugLoc(), TII->get(X86::JMP_4)).addMBB(&entry);
-  newBlock->addSuccessor(&entry);
+  currentFakeBlock = nullptr;
+  branchLoc = DebugLoc();
+
+  // A dispatcher runs whenever one of its fake blocks does
+  if (!dispatchers.empty() && tracksFrequencies())
+    for (auto *fakeBlock : fakeBlocks)
+      for (auto *dispatcher : fakeBlock->successors())
+        trampolineFreqs[dispatcher] += trampolineFreqs.lookup(fakeBlock);
+
+  if (preLayout) {
+    if (TrampolineTable)
+      report_fatal_error("-x86-bc-trampoline-table is not supported in pre-layout mode");
+    finishPreLayout(MF, entry);
+  } else {
+    if (TrampolineLayoutMode == TL_Profile)
+      layoutTrampolines(MF, entry);
+
+    // Trampolines in their own section are out of the way, otherwise the function has to jump over them
+    if (!placeTrampolinesInSection(MF, entry)) {
+      MachineBasicBlock *newBlock = MF.CreateMachineBasicBlock();
+      MF.push_front(newBlock);
+      // Replaces no branch, and a location would move the end of the prologue in front of it
+      countBytes(BuildMI(newBlock, DebugLoc(), TII->get(getJumpOpcode())).addMBB(&entry));
+      newBlock->addSuccessor(&entry);
+      if (tracksFrequencies())
+        trampolineFreqs[newBlock] = getBlockFreq(&entry);
+    } else if (TrampolineTable) {
+      addTrampolineTable(MF, entry);
+    }
+  }
+
+  reportStats(MF, entry);
+  if (reportsOverhead())
+    reportOverhead(MF, entry);
 
   // Cleanup
-  for (auto child : *takenBlocks) {
-    delete child;
+  lanes.clear();
+  skipLaneByDest.clear();
+  laneAllocator.Reset();
+  processedMBBs.clear();
+  liveOutUnits.clear();
+  blockFreqs.clear();
+  edgeFreqs.clear();
+  trampolineFreqs.clear();
+  fakeBlocks.clear();
+  createdBlocks.clear();
+  dispatchers.clear();
+  fakeEdgeFreqs.clear();
+  blockCycles.clear();
+  ORE = nullptr;
+
+  return true;
+}
+
+bool X86BranchConversion::tracksFrequencies() const {
+  return preLayout || TrampolineLayoutMode == TL_Profile || reportsOverhead();
+}
+
+bool X86BranchConversion::reportsOverhead() {
+  return OverheadReport || OverheadBudget != 0;
+}
+
+void X86BranchConversion::collectProfile(MachineFunction &MF) {
+  if (!tracksFrequencies())
+    return;
+
+  // MBFI already folds in any PGO branch weights, so there is no need to look at the profile directly.
+  auto &MBFI = getAnalysis<MachineBlockFrequencyInfo>();
+  auto &MBPI = getAnalysis<MachineBranchProbabilityInfo>();
+  entryFreq = MBFI.getEntryFreq();
+
+  for (auto &MBB : MF) {
+    auto freq = MBFI.getBlockFreq(&MBB);
+    blockFreqs[&MBB] = freq.getFrequency();
+    for (auto *succ : MBB.successors())
+      edgeFreqs[std::make_pair(&MBB, succ)] = (freq * MBPI.getEdgeProbability(&MBB, succ)).getFrequency();
   }
-  delete takenBlocks;
-  delete processedMBBs;
+}
 
+uint64_t X86BranchConversion::getBlockFreq(const MachineBasicBlock *MBB) const {
+  auto it = blockFreqs.find(MBB);
+  return it == blockFreqs.end() ? 0 : it->second;
+}
+
+uint64_t X86BranchConversion::getEdgeFreq(const MachineBasicBlock *src, const MachineBasicBlock *dst) const {
+  auto it = edgeFreqs.find(std::make_pair(src, dst));
+  return it == edgeFreqs.end() ? 0 : it->second;
+}
+
+/**
+ * @brief reorder the trampoline region according to the estimated trampoline frequencies
+ *
+ * The trampolines are sorted so that the hottest ones end up packed together right in front of the
+ * function body, while cold trampolines are pushed towards the start of the region. Ties keep their
+ * original relative order.
+ *
+ * @param MF The machine function being converted
+ * @param entry The original entry block, i.e., the first block after the trampoline region
+ */
+void X86BranchConversion::layoutTrampolines(MachineFunction &MF, MachineBasicBlock &entry) {
+  SmallVector<MachineBasicBlock *, 32> trampolines;
+  for (auto &MBB : MF) {
+    if (&MBB == &entry)
+      break;
+    trampolines.push_back(&MBB);
+  }
+
+  std::stable_sort(trampolines.begin(), trampolines.end(),
+                   [this](const MachineBasicBlock *a, const MachineBasicBlock *b) {
+                     return trampolineFreqs.lookup(a) < trampolineFreqs.lookup(b);
+                   });
+
+  for (auto *MBB : trampolines)
+    MF.splice(entry.getIterator(), MBB);
+}
+
+/**
+ * @brief have the trampoline region emitted into the trampoline section, if one is configured
+ *
+ * The AsmPrinter switches sections around the region (see X86AsmPrinter::EmitBasicBlockStart), so the
+ * function symbol ends up pointing directly at the entry block. Functions in a COMDAT always get their
+ * own section, which is put into the same group so it is discarded along with the function.
+ *
+ * @param MF The machine function being converted
+ * @param entry The original entry block, i.e., the first block after the trampoline region
+ * @return true if the trampolines are emitted into a separate section
+ */
+bool X86BranchConversion::placeTrampolinesInSection(MachineFunction &MF, MachineBasicBlock &entry) {
+  std::string name = TrampolineSectionName;
+  if (name.empty() && (BranchConversionWholeProgramLayout || TrampolineTable))
+    name = ".text.bcv_tramp";
+  if (name.empty() || &MF.front() == &entry)
+    return false;
+
+  if (!TM->getTargetTriple().isOSBinFormatELF())
+    report_fatal_error("-x86-bc-trampoline-section is only supported for ELF targets");
+  if (!isPowerOf2_32(TrampolineAlignment))
+    report_fatal_error("-x86-bc-trampoline-align must be a power of two");
+
+  if (TrampolineSectionPerFunction || MF.getFunction().hasComdat())
+    name += ("." + MF.getName()).str();
+
+  MF.getInfo<X86MachineFunctionInfo>()->setTrampolineSection(&MF.front(), entry.getPrevNode(), name,
+                                                             TrampolineAlignment);
   return true;
 }
 
+/**
+ * @brief have the AsmPrinter describe the trampoline region in the trampoline table
+ *
+ * Every trampoline block becomes a range of the table, and every reference into or out of the region
+ * (LEAs and jumps, jump table entries) a fixup, see X86AsmPrinter::emitTrampolineTable. A run-time
+ * library can then move the blocks around and patch the fixups. The blocks are only referenced by
+ * their labels from now on, so they are marked as address taken to keep the labels. A fixup patches
+ * the last four bytes of an instruction, which rules out jumps the assembler may relax.
+ *
+ * @param MF The machine function being converted
+ * @param entry The original entry block, i.e., the first block after the trampoline region
+ */
+void X86BranchConversion::addTrampolineTable(MachineFunction &MF, MachineBasicBlock &entry) {
+  if (getJumpOpcode() != X86::JMP_4)
+    report_fatal_error("-x86-bc-trampoline-table does not support -x86-bc-short-jumps");
+
+  for (auto &MBB : MF) {
+    if (&MBB == &entry)
+      break;
+    MBB.setHasAddressTaken();
+  }
+
+  MF.getInfo<X86MachineFunctionInfo>()->setTrampolineTable();
+}
+
+/**
+ * @brief hand the converted function over to block placement (pre-layout mode)
+ *
+ * The trampoline region moves behind the function body, so the original entry is the entry block again
+ * and needs no jump over the trampolines. Block placement then lays out the trampolines like any other
+ * block, guided by the probabilities of the edges leaving the fake blocks, and drops the jumps of the
+ * trampolines it places in front of their targets. X86BranchConversionVerifier checks the result once
+ * the layout is final.
+ *
+ * @param MF The machine function being converted
+ * @param entry The original entry block, i.e., the first block after the trampoline region
+ */
+void X86BranchConversion::finishPreLayout(MachineFunction &MF, MachineBasicBlock &entry) {
+  if (&MF.front() != &entry)
+    MF.splice(MF.end(), MF.begin(), entry.getIterator());
+
+  for (auto *fakeBlock : fakeBlocks) {
+    uint64_t total = 0;
+    for (auto *succ : fakeBlock->successors())
+      total += fakeEdgeFreqs.lookup(std::make_pair(fakeBlock, succ));
+    // Without any frequency, the unknown probabilities are treated as uniform
+    if (total == 0)
+      continue;
+    for (auto it = fakeBlock->succ_begin(), end = fakeBlock->succ_end(); it != end; ++it)
+      fakeBlock->setSuccProbability(
+          it, BranchProbability::getBranchProbability(fakeEdgeFreqs.lookup(std::make_pair(fakeBlock, *it)), total));
+  }
+
+  if (MRI->tracksLiveness())
+    updateLiveIns();
+
+  // Layout may merge or drop blocks, but it must never add a branch site or a conditional branch
+  unsigned condBranches = 0;
+  for (auto &MBB : MF)
+    for (auto &MI : MBB.terminators())
+      if (MI.isConditionalBranch())
+        ++condBranches;
+  MF.getInfo<X86MachineFunctionInfo>()->setBranchConversionPreLayout(fakeBlocks.size(), condBranches);
+}
+
+/**
+ * @brief compute the live-ins of the blocks we created
+ *
+ * The passes between here and emission rely on them. A register is live into a fake block if it is live
+ * into any of its trampolines, so the sets are propagated backwards until nothing changes. The original
+ * blocks keep their live-ins, they only get more live-outs through their fake block, which is
+ * conservative.
+ */
+void X86BranchConversion::updateLiveIns() {
+  SmallPtrSet<MachineBasicBlock *, 32> created(createdBlocks.begin(), createdBlocks.end());
+  SmallVector<MachineBasicBlock *, 64> worklist(createdBlocks.rbegin(), createdBlocks.rend());
+  SmallPtrSet<MachineBasicBlock *, 32> queued(created);
+  LivePhysRegs liveRegs;
+
+  while (!worklist.empty()) {
+    auto *MBB = worklist.pop_back_val();
+    queued.erase(MBB);
+
+    SmallVector<MachineBasicBlock::RegisterMaskPair, 8> oldLiveIns(MBB->livein_begin(), MBB->livein_end());
+    MBB->clearLiveIns();
+    computeAndAddLiveIns(liveRegs, *MBB);
+    MBB->sortUniqueLiveIns();
+
+    auto liveIns = MBB->liveins();
+    if ((size_t)std::distance(liveIns.begin(), liveIns.end()) == oldLiveIns.size() &&
+        std::equal(oldLiveIns.begin(), oldLiveIns.end(), liveIns.begin(),
+                   [](const MachineBasicBlock::RegisterMaskPair &a, const MachineBasicBlock::RegisterMaskPair &b) {
+                     return a.PhysReg == b.PhysReg && a.LaneMask == b.LaneMask;
+                   }))
+      continue;
+
+    for (auto *pred : MBB->predecessors())
+      if (created.count(pred) && queued.insert(pred).second)
+        worklist.push_back(pred);
+  }
+}
+
+/**
+ * @brief record that the fake block of the block being converted may jump to succ (pre-layout mode)
+ *
+ * @param succ The trampoline reached through the fake block
+ * @param freq The frequency of the path taking this edge
+ */
+void X86BranchConversion::addFakeBlockSuccessor(MachineBasicBlock *succ, uint64_t freq) {
+  if (!preLayout)
+    return;
+
+  assert(currentFakeBlock != nullptr && "no fake block to add the edge to");
+  auto inserted = fakeEdgeFreqs.insert(std::make_pair(std::make_pair(currentFakeBlock, succ), 0));
+  if (inserted.second)
+    currentFakeBlock->addSuccessor(succ);
+  inserted.first->second += freq;
+}
+
+/**
+ * @brief make MBB fall through into its fake block in the CFG (pre-layout mode)
+ *
+ * After conversion, MBB no longer branches to its original successors, they are reached through the
+ * trampolines. Targets of kept conditional branches stay successors of MBB. The targets of a converted
+ * indirect jump become successors of the fake block instead.
+ *
+ * @param MBB The converted block
+ * @param transferSuccs Whether the successors of MBB are reached through the fake block directly
+ */
+void X86BranchConversion::routeThroughFakeBlock(MachineBasicBlock &MBB, bool transferSuccs) {
+  if (!preLayout)
+    return;
+
+  assert(currentFakeBlock != nullptr && "converted block without a fake block");
+
+  SmallPtrSet<MachineBasicBlock *, 2> kept;
+  for (auto &MI : MBB.terminators())
+    for (auto &op : MI.operands())
+      if (op.isMBB())
+        kept.insert(op.getMBB());
+
+  SmallVector<MachineBasicBlock *, 4> stale;
+  for (auto *succ : MBB.successors()) {
+    if (transferSuccs)
+      addFakeBlockSuccessor(succ, getEdgeFreq(&MBB, succ));
+    if (!kept.count(succ))
+      stale.push_back(succ);
+  }
+
+  // The first replaced edge passes its probability on to the fake block
+  for (auto *succ : stale) {
+    if (MBB.isSuccessor(currentFakeBlock))
+      MBB.removeSuccessor(succ);
+    else
+      MBB.replaceSuccessor(succ, currentFakeBlock);
+  }
+  if (!MBB.isSuccessor(currentFakeBlock))
+    MBB.addSuccessor(currentFakeBlock);
+  MBB.normalizeSuccProbs();
+}
+
 bool X86BranchConversion::replaceNoBranchBlock(MachineFunction &MF, MachineBasicBlock &MBB,
                                                MachineInstrBundleIterator<MachineInstr, false> iter,
                                                MachineBasicBlock *fallThrough,
@@ -331,18 +1158,22 @@ bool X86BranchConversion::replaceNoBranchBlock(MachineFunction &MF, MachineBasic
   BC_DEBUG(dump_MI_with_operands("non-branch", nullptr));
   BC_DEBUG(dump_target("fallthrough", fallThrough));
 
-  if (fallThrough != nullptr) {
-    auto zbN_p1 = CreateNewBBonTrampoline(MBB, MF, nullptr);
-    updateLane(takenLane, zbN_p1, nullptr, true);
-
-    BuildMI(MBB, ++iter, DebugLoc(), TII->get(X86::LEA64r), targetRegOpcode)
-        .addReg(X86::RIP)
-        .addImm(0)
-        .addReg(0)
-        .addMBB(zbN_p1)
-        .addReg(0);
-
-
+  if (fallThrough != nullptr && MBB.getNextNode() == fallThrough) {
+    // No fake block was inserted (see isSiteless), so just fall through without using the trampoline
+    LANE_DEBUG(errs() << "!!! collapsing site-less block\n");
+    updateLane(takenLane, nullptr, nullptr, true, getBlockFreq(&MBB));
+  } else if (fallThrough != nullptr) {
+    auto zbN_p1 = CreateNewBBonTrampoline(MBB, MF, nullptr, getBlockFreq(&MBB));
+    updateLane(takenLane, zbN_p1, nullptr, true, getBlockFreq(&MBB));
+
+    countBytes(BuildMI(MBB, ++iter, branchLoc, TII->get(X86::LEA64r), targetReg)
+                   .addReg(X86::RIP)
+                   .addImm(0)
+                   .addReg(0)
+                   .addMBB(zbN_p1)
+                   .addReg(0));
+    ++stats.fallThroughs;
+    routeThroughFakeBlock(MBB, false);
   } else {
     updateLane(takenLane, nullptr, nullptr, false);
     LANE_DEBUG(errs() << "!!! invalidating lane\n");
@@ -359,33 +1190,89 @@ bool X86BranchConversion::replaceIndirectJump(MachineFunction &MF, MachineBasicB
   auto &MI = *iter;
   BC_DEBUG(dump_MI_with_operands("indirect branch", &MI));
 
-  // get the first operand of MachineInstr
-  auto operand = MI.getOperand(0);
-  assert(operand.isReg() && "support for non register operands is unimplemented");
-
-  // FIXME: This just disables handling of indirect jumps...
+  // Load the target into our register and let the fake block do the jump, so the indirect jump happens
+  // at the same kind of site as every other branch. Jump table targets already point into the
+  // trampoline (see redirectJumpTables).
+  bool converted = true;
+  if (MI.getOpcode() == X86::JMP64r) {
+    countBytes(BuildMI(MBB, iter, branchLoc, TII->get(X86::MOV64rr), targetReg)
+                   .addReg(MI.getOperand(0).getReg()));
+  } else if (MI.getOpcode() == X86::JMP64m) {
+    auto MIB = BuildMI(MBB, iter, branchLoc, TII->get(X86::MOV64rm), targetReg);
+    for (unsigned i = 0; i < X86::AddrNumOperands; ++i)
+      MIB.add(MI.getOperand(i));
+    MIB.setMemRefs(MI.memoperands_begin(), MI.memoperands_end());
+    countBytes(MIB);
+  } else {
+    // FIXME: other forms (e.g., 32-bit or retpoline thunks) are left as is
+    converted = false;
+    ORE->emit([&]() {
+      return MachineOptimizationRemarkMissed(DEBUG_TYPE, "IndirectBranchNotConverted", MI.getDebugLoc(), &MBB)
+             << "indirect branch " << ore::NV("Opcode", TII->getName(MI.getOpcode())) << " not converted";
+    });
+  }
 
-#ifdef DONT_DISABLE_INDIRECT_JUMP_INSTRUMENTATION
-  auto zbN_p1 = CreateNewBBonTrampoline(MBB, MF, nullptr);
+  if (converted) {
+    iter->eraseFromParent();
+    ++stats.indirectJumps;
+    routeThroughFakeBlock(MBB, true);
+  }
 
-  // Unclear how to handle this since we do not know the target of the jump before run-time
-  BuildMI(zbN_p1, DebugLoc(), TII->get(X86::JMP64r)).addReg(operand.getReg());
-  // FIXME: we just assume the register is 64bits, guess it could also be 32?
+  // Invalidate this lane, we have no idea where its going...
+  updateLane(takenLane, nullptr, nullptr, false);
 
-  BuildMI(MBB, iter, DebugLoc(), TII->get(X86::LEA64r), targetRegOpcode)
-                .addReg(X86::RIP)
-                .addImm(0)
-                .addReg(0)
-                .addMBB(zbN_p1)
-                .addReg(0);
+  return converted;
+}
 
-  iter->eraseFromParent();
-#endif
+/**
+ * @brief point all jump table entries to trampoline blocks instead of the real targets
+ *
+ * Each jump table target gets one trampoline entry block, shared between all tables of the function,
+ * that simply jumps to the target. The dispatching indirect jump thereby lands in the trampoline like
+ * any other converted branch, and stays O(1) regardless of the number of cases.
+ *
+ * @param MF The machine function being converted
+ */
+void X86BranchConversion::redirectJumpTables(MachineFunction &MF) {
+  auto *MJTI = MF.getJumpTableInfo();
+  if (MJTI == nullptr || MJTI->isEmpty())
+    return;
+
+  DenseMap<MachineBasicBlock *, MachineBasicBlock *> entries;
+  for (const auto &JT : MJTI->getJumpTables())
+    for (auto *target : JT.MBBs)
+      entries[target] = nullptr;
+
+  for (auto &MBB : MF) {
+    if (MBB.empty() || !MBB.back().isIndirectBranch())
+      continue;
 
-  // Invalidate this lane, we have no idea where its going...
-  updateLane(takenLane, nullptr, nullptr, false);
+    // The entries carry the location of the indirect jump
+    branchLoc = MBB.back().getDebugLoc();
+
+    // Collect first, replacing successors while iterating over them is not safe
+    SmallVector<MachineBasicBlock *, 8> targets;
+    for (auto *succ : MBB.successors())
+      if (entries.count(succ))
+        targets.push_back(succ);
+
+    for (auto *target : targets) {
+      auto &entryBlock = entries[target];
+      if (entryBlock == nullptr)
+        entryBlock = CreateNewBBonTrampoline(MBB, MF, target, getEdgeFreq(&MBB, target));
+      else if (tracksFrequencies())
+        trampolineFreqs[entryBlock] += getEdgeFreq(&MBB, target);
+      // The converted indirect jump reaches the entry instead of the target
+      if (tracksFrequencies())
+        edgeFreqs[std::make_pair(&MBB, entryBlock)] += getEdgeFreq(&MBB, target);
+
+      MBB.replaceSuccessor(target, entryBlock);
+    }
+  }
 
-  return true;
+  for (auto &entry : entries)
+    if (entry.second != nullptr)
+      MJTI->ReplaceMBBInJumpTables(entry.first, entry.second);
 }
 
 
@@ -404,22 +1291,31 @@ bool X86BranchConversion::replaceUnconditionalJump(MachineFunction &MF, MachineB
   auto dstMBB = operand.getMBB();
   BC_DEBUG(dump_target("target", dstMBB));
   MachineBasicBlock *zbN_p1;
-  if (processedMBBs->find(dstMBB) != processedMBBs->end()) {
-    zbN_p1 = CreateNewBBonTrampoline(MBB, MF, dstMBB);
+  uint64_t freq = getBlockFreq(&MBB);
+  struct blockLane *sharedLane = nullptr;
+  if (isProcessed(dstMBB)) {
+    zbN_p1 = CreateNewBBonTrampoline(MBB, MF, dstMBB, freq, getLoopTrampolinePos(MBB, dstMBB));
+    updateLane(takenLane, nullptr, nullptr, false);
+  } else if ((sharedLane = joinSkipLane(dstMBB, freq)) != nullptr) {
+    // Continue on the lane already heading to dstMBB, ours is no longer needed
+    zbN_p1 = sharedLane->currentMBB;
+    addFakeBlockSuccessor(zbN_p1, freq);
     updateLane(takenLane, nullptr, nullptr, false);
   } else {
-    zbN_p1 = CreateNewBBonTrampoline(MBB, MF, nullptr);
-    updateLane(takenLane, zbN_p1, dstMBB, false);
+    zbN_p1 = CreateNewBBonTrampoline(MBB, MF, nullptr, freq);
+    updateLane(takenLane, zbN_p1, dstMBB, false, freq);
   }
 
-  BuildMI(MBB, iter, DebugLoc(), TII->get(X86::LEA64r), targetRegOpcode)
-      .addReg(X86::RIP)
-      .addImm(0)
-      .addReg(0)
-      .addMBB(zbN_p1)
-      .addReg(0);
+  countBytes(BuildMI(MBB, iter, branchLoc, TII->get(X86::LEA64r), targetReg)
+                 .addReg(X86::RIP)
+                 .addImm(0)
+                 .addReg(0)
+                 .addMBB(zbN_p1)
+                 .addReg(0));
 
   iter->eraseFromParent();
+  ++stats.jumps;
+  routeThroughFakeBlock(MBB, false);
 
   return true;
 }
@@ -446,58 +1342,492 @@ bool X86BranchConversion::replaceConditionalBranch(MachineFunction &MF, MachineB
   // Determine what kind of test we are using
   auto cmovOpcode = getCorrespondingMovOpcode(MI);
 
+  // Split the frequency of MBB between the taken and fallthrough paths
+  uint64_t freq = getBlockFreq(&MBB);
+  uint64_t takenFreq = getEdgeFreq(&MBB, dstMBB);
+  uint64_t fallThroughFreq = freq > takenFreq ? freq - takenFreq : 0;
+
+  if (!isSecretBranch(MBB, dstMBB))
+    return keepConditionalBranch(MF, MBB, iter, takenLane, fallThroughFreq);
+
+  requireTmpReg(MBB);
+
+  // The SETcc lowering needs a fresh taken trampoline right behind the fallthrough one, so branches
+  // joining an existing skip lane keep using CMOV
+  if (setccLowering) {
+    auto lane = skipLaneByDest.lookup(dstMBB);
+    if (isProcessed(dstMBB) || lane == nullptr || lane->currentMBB == nullptr)
+      return replaceConditionalBranchWithSetcc(MF, MBB, iter, dstMBB, takenLane, takenFreq, fallThroughFreq);
+  }
+
+  // Loop latches keep both of their trampolines next to the loop, so the exit path stays local as well
+  auto loopPos = getLoopTrampolinePos(MBB, dstMBB);
+
   // Create the trampoline blocks we're going to need when no skipping
-  auto zbN_p1_F = CreateNewBBonTrampoline(MBB, MF, nullptr);
+  auto zbN_p1_F = CreateNewBBonTrampoline(MBB, MF, nullptr, fallThroughFreq, loopPos);
 
   MachineBasicBlock *zbN_p1;
+  struct blockLane *sharedLane = nullptr;
 
-  if (processedMBBs->find(dstMBB) != processedMBBs->end()) {
+  if (isProcessed(dstMBB)) {
     LANE_DEBUG(errs() << "!!! jumping backwards, skipping new lane creation for conditional");
-    zbN_p1 = CreateNewBBonTrampoline(MBB, MF, dstMBB);
+    zbN_p1 = CreateNewBBonTrampoline(MBB, MF, dstMBB, takenFreq, loopPos ? zbN_p1_F : nullptr);
+  } else if ((sharedLane = joinSkipLane(dstMBB, takenFreq)) != nullptr) {
+    LANE_DEBUG(errs() << "!!! joining existing lane for the same destination\n");
+    zbN_p1 = sharedLane->currentMBB;
+    addFakeBlockSuccessor(zbN_p1, takenFreq);
   } else {
-    zbN_p1 = CreateNewBBonTrampoline(MBB, MF, nullptr);
+    zbN_p1 = CreateNewBBonTrampoline(MBB, MF, nullptr, takenFreq);
     // Add new lane for the taken jump
     addBBtoBlockLane(
         zbN_p1,   // Goes via fake zb(N+1)F
         dstMBB,     // We should eventually reach dstMBB
-        false       // , but not take the next MBB
+        false,      // , but not take the next MBB
+        takenFreq
     );
   }
 
   // Insert the default, fallthrough move
   BC_DEBUG(errs() << "\t\t\t" << "just trying hasAddressTaken for MBB: " << MBB.hasAddressTaken() << "\n");
 
-  BuildMI(MBB, iter, DebugLoc(), TII->get(X86::LEA64r), targetRegOpcode)
-      .addReg(X86::RIP)
-      .addImm(0)
-      .addReg(0)
-      .addMBB(zbN_p1_F)
-      .addReg(0);
-
-  BuildMI(MBB, iter, DebugLoc(), TII->get(X86::LEA64r), tmpReg)
-      .addReg(X86::RIP)
-      .addImm(0)
-      .addReg(0)
-      .addMBB(zbN_p1)
-      .addReg(0);
-
-  BuildMI(MBB, iter, DebugLoc(), TII->get(cmovOpcode), X86::R11)
-      // FIXME: should probably figure out what op0 (X86:R11) does
-      .addReg(targetRegOpcode) // dst register
-      .addReg(tmpReg);  // src register
+  countBytes(BuildMI(MBB, iter, branchLoc, TII->get(X86::LEA64r), targetReg)
+                 .addReg(X86::RIP)
+                 .addImm(0)
+                 .addReg(0)
+                 .addMBB(zbN_p1_F)
+                 .addReg(0));
+
+  countBytes(BuildMI(MBB, iter, branchLoc, TII->get(X86::LEA64r), tmpReg)
+                 .addReg(X86::RIP)
+                 .addImm(0)
+                 .addReg(0)
+                 .addMBB(zbN_p1)
+                 .addReg(0));
+
+  // CMOV is two-address, the def is tied to the first source
+  countBytes(BuildMI(MBB, iter, branchLoc, TII->get(cmovOpcode), targetReg)
+                 .addReg(targetReg)
+                 .addReg(tmpReg, RegState::Kill));
 
   // and finally, remove the original conditional jump
   iter->eraseFromParent();
+  ++stats.condBranches;
+  routeThroughFakeBlock(MBB, false);
 
   // Treat the takenLane as the fallthrough
-  updateLane(takenLane, zbN_p1_F, nullptr, true);
+  updateLane(takenLane, zbN_p1_F, nullptr, true, fallThroughFreq);
+
+  LANE_DEBUG(errs() << "!!! splitting lane (lanes " << lanes.size() << ")\n");
+
+  return true;
+}
+
+/**
+ * @brief fuse chains of conditional branches to the same target into a single branch
+ *
+ * Short-circuit conditions such as a && b && c leave a chain of blocks that each test one condition and
+ * branch to the same target, falling through to the next test otherwise. Converted, every one of them
+ * would get its own trampolines and fake block, so the path through the chain takes one indirect jump per
+ * condition. Where the later tests can run unconditionally, the chain is merged into its first block and
+ * takes a single one.
+ *
+ * @param MF The machine function, before any conversion
+ */
+void X86BranchConversion::fuseConditionChains(MachineFunction &MF) {
+  for (auto &head : MF) {
+    MachineBasicBlock *exit = nullptr;
+    MachineBasicBlock *target = getChainTarget(head, exit);
+    if (target == nullptr || !isSecretBranch(head, target))
+      continue;
+
+    // Every link is only entered by falling through from the previous one
+    SmallVector<MachineBasicBlock *, 4> chain = {&head};
+    while (exit != nullptr && exit == chain.back()->getNextNode() &&
+           std::next(chain.back()->getFirstTerminator()) == chain.back()->end() && exit != target &&
+           exit->pred_size() == 1 && !exit->hasAddressTaken() && !exit->isEHPad() && canSpeculate(*exit)) {
+      MachineBasicBlock *linkExit = nullptr;
+      if (getChainTarget(*exit, linkExit) != target || linkExit == target || !isSecretBranch(*exit, target))
+        break;
+      chain.push_back(exit);
+      exit = linkExit;
+    }
+
+    if (chain.size() > 1 && fuseConditionChain(chain, target, exit))
+      stats.fusedCondBranches += chain.size() - 1;
+  }
+}
+
+/**
+ * @brief merge a chain of conditional branches into its first block
+ *
+ * Each condition is stored with SETcc and ORed into an accumulator, and the flags of the last OR decide
+ * the single remaining branch:
+ *
+ *     head: ...; jcc0 target         head: ...; setcc0 acc
+ *     link: ...; jcc1 target   =>          ...; setcc1 cond; or cond, acc
+ *     last: ...; jcc2 target                ...; setcc2 cond; or cond, acc
+ *     exit:                                 jne target
+ *
+ * The links now also run when the chain leaves early, so nothing they define may be live into the
+ * target, and both exits see the flags of the OR instead of the compare that decided them.
+ *
+ * @param chain The blocks of the chain in layout order, see fuseConditionChains
+ * @param target The common target of their branches
+ * @param exit The block reached when no condition holds
+ * @return true if the chain was merged, false if it needs registers that are not free
+ */
+bool X86BranchConversion::fuseConditionChain(ArrayRef<MachineBasicBlock *> chain, MachineBasicBlock *target,
+                                             MachineBasicBlock *exit) {
+  MachineBasicBlock *head = chain.front();
+  MachineBasicBlock *last = chain.back();
+
+  if (target->isLiveIn(X86::EFLAGS) || exit->isLiveIn(X86::EFLAGS))
+    return false;
+
+  LiveRegUnits targetLiveIns(*TRI);
+  targetLiveIns.addLiveIns(*target);
+  LiveRegUnits busy(*TRI);
+  busy.addLiveOuts(*last);
+  for (auto *link : chain.drop_front()) {
+    for (auto &MI : *link) {
+      for (auto &op : MI.operands()) {
+        if (!op.isReg() || op.getReg() == 0)
+          continue;
+        if (op.isDef() && op.getReg() != X86::EFLAGS && !targetLiveIns.available(op.getReg()))
+          return false;
+        busy.addReg(op.getReg());
+      }
+    }
+  }
+
+  unsigned accReg = X86::NoRegister;
+  unsigned condReg = X86::NoRegister;
+  if (BranchConversionReserveRegs) {
+    // Only used by our own sequences, which go behind the fused branch
+    accReg = X86::R11;
+    condReg = X86::R10;
+  } else {
+    for (auto reg : scratchCandidates) {
+      if (MRI->isReserved(reg) || !busy.available(reg))
+        continue;
+      if (accReg == X86::NoRegister) {
+        accReg = reg;
+      } else {
+        condReg = reg;
+        break;
+      }
+    }
+    if (condReg == X86::NoRegister)
+      return false;
+  }
+  unsigned acc8 = TRI->getSubReg(accReg, X86::sub_8bit);
+  unsigned cond8 = TRI->getSubReg(condReg, X86::sub_8bit);
+
+  // The chain falls through only if every link does
+  auto &MBPI = getAnalysis<MachineBranchProbabilityInfo>();
+  BranchProbability fallThroughProb = BranchProbability::getOne();
+  for (unsigned i = 0, e = chain.size(); i != e; ++i)
+    fallThroughProb *= MBPI.getEdgeProbability(chain[i], i + 1 == e ? exit : chain[i + 1]);
+
+  auto headBranch = head->getFirstTerminator();
+  DebugLoc DL = headBranch->getDebugLoc();
+  countBytes(BuildMI(*head, headBranch, DL,
+                     TII->get(X86::getSETFromCond(X86::getCondFromBranchOpc(headBranch->getOpcode()))), acc8));
+  headBranch->eraseFromParent();
+  head->removeSuccessor(chain[1]);
+
+  for (auto *link : chain.drop_front()) {
+    auto branch = link->getFirstTerminator();
+    X86::CondCode CC = X86::getCondFromBranchOpc(branch->getOpcode());
+    head->splice(head->end(), link, link->begin(), branch);
+    countBytes(BuildMI(head, branch->getDebugLoc(), TII->get(X86::getSETFromCond(CC)), cond8));
+    countBytes(BuildMI(head, branch->getDebugLoc(), TII->get(X86::OR8rr), acc8)
+                   .addReg(acc8, RegState::Kill)
+                   .addReg(cond8, RegState::Kill));
+  }
 
-  LANE_DEBUG(errs() << "!!! splitting lane (lanes " << takenBlocks->size() << ")\n");
+  // Followed by the unconditional jump of the last link, if it has one
+  BuildMI(head, DL, TII->get(X86::JNE_1)).addMBB(target);
+  head->splice(head->end(), last, std::next(last->getFirstTerminator()), last->end());
+  head->addSuccessor(exit, fallThroughProb);
+  head->setSuccProbability(std::find(head->succ_begin(), head->succ_end(), target), fallThroughProb.getCompl());
+
+  for (auto *link : chain.drop_front()) {
+    while (!link->succ_empty())
+      link->removeSuccessor(link->succ_begin());
+    // Trampolines created later may reuse the memory of the erased blocks
+    if (LocalLoopTrampolines)
+      getAnalysis<MachineLoopInfo>().removeBlock(link);
+    link->eraseFromParent();
+  }
 
   return true;
 }
 
-void X86BranchConversion::addDummyInstructions(MachineBasicBlock *realBlock, MachineBasicBlock *trampolineBlock) {
+/**
+ * @brief get the target of a block that ends in a single conditional branch
+ *
+ * @param MBB The block to check
+ * @param exit Set to the other successor of MBB, reached by falling through or by an unconditional jump
+ * @return the target of the conditional branch, or nullptr if MBB does not end in exactly one
+ */
+MachineBasicBlock *X86BranchConversion::getChainTarget(MachineBasicBlock &MBB, MachineBasicBlock *&exit) const {
+  MachineBasicBlock *TBB = nullptr;
+  MachineBasicBlock *FBB = nullptr;
+  SmallVector<MachineOperand, 1> cond;
+  if (MBB.succ_size() != 2 || TII->analyzeBranch(MBB, TBB, FBB, cond, false) || cond.size() != 1 ||
+      cond[0].getImm() > X86::LAST_VALID_COND || TBB == nullptr)
+    return nullptr;
+
+  exit = FBB != nullptr ? FBB : MBB.getNextNode();
+  return exit != TBB ? TBB : nullptr;
+}
+
+/**
+ * @brief check whether a block can run even when the branch in front of it would skip it
+ *
+ * @param MBB The block to check
+ * @return true if MBB neither reads the flags it is entered with nor has side effects or may trap
+ */
+bool X86BranchConversion::canSpeculate(const MachineBasicBlock &MBB) {
+  if (MBB.isLiveIn(X86::EFLAGS))
+    return false;
+
+  for (auto &MI : MBB) {
+    if (MI.isTerminator() || MI.isDebugValue())
+      continue;
+    if (MI.mayStore() || MI.isCall() || MI.hasUnmodeledSideEffects() || MI.isInlineAsm() ||
+        (MI.mayLoad() && !MI.isDereferenceableInvariantLoad(nullptr)))
+      return false;
+
+    switch (MI.getOpcode()) {
+    case X86::DIV8r:
+    case X86::DIV16r:
+    case X86::DIV32r:
+    case X86::DIV64r:
+    case X86::IDIV8r:
+    case X86::IDIV16r:
+    case X86::IDIV32r:
+    case X86::IDIV64r:
+      return false; // division by zero or overflow traps
+    default:
+      break;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * @brief replace a secret conditional branch without a CMOV
+ *
+ * The fallthrough trampoline only ever holds the 5 byte jump to the next block. With both trampolines
+ * aligned to 8 bytes and the taken one placed right behind it, the taken trampoline is exactly 8 bytes
+ * further, so the target address is the fallthrough trampoline plus the SETcc result scaled by 8:
+ *
+ *     setcc   tmp8
+ *     movzbl  tmp8, tmp32
+ *     leaq    zbN_p1_F(%rip), target
+ *     leaq    (target,tmp,8), target
+ *
+ * Both paths execute the same instructions, only the index differs. x86-64 cannot combine a RIP-relative
+ * displacement with an index register, so a table of trampoline addresses would need the same two
+ * instructions plus a load, while the alignment keeps the trampolines themselves a plain jump.
+ *
+ * @param MF The machine function
+ * @param MBB The block ending in the conditional branch
+ * @param iter The conditional branch
+ * @param dstMBB The destination of the taken path, must not join an existing skip lane
+ * @param takenLane The lane that reached MBB
+ * @param takenFreq The frequency of the taken path
+ * @param fallThroughFreq The frequency of the fallthrough path
+ * @return true
+ */
+bool X86BranchConversion::replaceConditionalBranchWithSetcc(MachineFunction &MF, MachineBasicBlock &MBB,
+                                                            MachineInstrBundleIterator<MachineInstr, false> iter,
+                                                            MachineBasicBlock *dstMBB,
+                                                            struct blockLane *takenLane, uint64_t takenFreq,
+                                                            uint64_t fallThroughFreq) {
+  auto &MI = *iter;
+  auto loopPos = getLoopTrampolinePos(MBB, dstMBB);
+
+  // Created in reverse, both push_front and inserting after loopPos put the fallthrough trampoline first
+  MachineBasicBlock *zbN_p1;
+  if (isProcessed(dstMBB)) {
+    zbN_p1 = CreateNewBBonTrampoline(MBB, MF, dstMBB, takenFreq, loopPos);
+  } else {
+    zbN_p1 = CreateNewBBonTrampoline(MBB, MF, nullptr, takenFreq);
+    addBBtoBlockLane(zbN_p1, dstMBB, false, takenFreq);
+  }
+  auto zbN_p1_F = CreateNewBBonTrampoline(MBB, MF, nullptr, fallThroughFreq, loopPos);
+  assert(std::next(zbN_p1_F->getIterator()) == zbN_p1->getIterator() && "trampolines are not adjacent");
+
+  // Alignment is log2, the padding behind the jump of zbN_p1_F is never executed
+  zbN_p1_F->setAlignment(3);
+  zbN_p1->setAlignment(3);
+
+  unsigned tmpReg8 = TRI->getSubReg(tmpReg, X86::sub_8bit);
+  unsigned tmpReg32 = TRI->getSubReg(tmpReg, X86::sub_32bit);
+  X86::CondCode CC = X86::getCondFromBranchOpc(MI.getOpcode());
+
+  countBytes(BuildMI(MBB, iter, branchLoc, TII->get(X86::getSETFromCond(CC)), tmpReg8));
+
+  // Writing the 32-bit register clears the upper half, which the scaled index below reads
+  countBytes(BuildMI(MBB, iter, branchLoc, TII->get(X86::MOVZX32rr8), tmpReg32)
+                 .addReg(tmpReg8, RegState::Kill)
+                 .addReg(tmpReg, RegState::ImplicitDefine));
+
+  countBytes(BuildMI(MBB, iter, branchLoc, TII->get(X86::LEA64r), targetReg)
+                 .addReg(X86::RIP)
+                 .addImm(0)
+                 .addReg(0)
+                 .addMBB(zbN_p1_F)
+                 .addReg(0));
+
+  countBytes(BuildMI(MBB, iter, branchLoc, TII->get(X86::LEA64r), targetReg)
+                 .addReg(targetReg)
+                 .addImm(8)
+                 .addReg(tmpReg, RegState::Kill)
+                 .addImm(0)
+                 .addReg(0));
+
+  iter->eraseFromParent();
+  ++stats.condBranches;
+  ++stats.setccCondBranches;
+  routeThroughFakeBlock(MBB, false);
+
+  updateLane(takenLane, zbN_p1_F, nullptr, true, fallThroughFreq);
+
+  return true;
+}
+
+/**
+ * @brief decide how the secret conditional branches of the current function are lowered
+ *
+ * The SETcc lowering relies on the two trampolines of a branch staying adjacent, which rules it out when
+ * they get reordered by the profile layout, by block placement or at run time (-x86-bc-trampoline-table).
+ * With -x86-bc-cond-lowering=auto, one branch lowered either way is compared by micro-ops, then by bytes
+ * including the alignment padding of the trampolines. The sizes assume the extended registers of the
+ * reserve mode, the micro-ops come from the scheduling model of the subtarget.
+ *
+ * @return true if conditional branches should use replaceConditionalBranchWithSetcc
+ */
+bool X86BranchConversion::prefersSetccLowering() const {
+  if (CondBranchLowering == CL_Cmov || preLayout || TrampolineLayoutMode == TL_Profile || TrampolineTable)
+    return false;
+  if (CondBranchLowering == CL_Setcc)
+    return true;
+
+  unsigned cmovUops = 2 * getOpcodeMicroOps(X86::LEA64r) + getOpcodeMicroOps(X86::CMOVE64rr);
+  unsigned setccUops =
+      getOpcodeMicroOps(X86::SETEr) + getOpcodeMicroOps(X86::MOVZX32rr8) + 2 * getOpcodeMicroOps(X86::LEA64r);
+  if (cmovUops != setccUops)
+    return setccUops < cmovUops;
+
+  // Two RIP-relative LEAs and CMOV, against SETcc, MOVZX, one RIP-relative and one scaled LEA, 3 bytes of
+  // padding behind the fallthrough trampoline and on average 4 in front of it
+  unsigned cmovBytes = 7 + 7 + 4;
+  unsigned setccBytes = 4 + 4 + 7 + 4 + 3 + 4;
+  return setccBytes < cmovBytes;
+}
+
+/**
+ * @brief get the micro-ops of an opcode from the scheduling model
+ *
+ * @param opcode The opcode to look up
+ * @return the number of micro-ops, 1 without a scheduling model
+ */
+unsigned X86BranchConversion::getOpcodeMicroOps(unsigned opcode) const {
+  if (!schedModel.hasInstrSchedModel())
+    return 1;
+  auto *desc = schedModel.getMCSchedModel()->getSchedClassDesc(TII->get(opcode).getSchedClass());
+  if (!desc->isValid() || desc->isVariant())
+    return 1;
+  return desc->NumMicroOps;
+}
+
+/**
+ * @brief check whether a block contains no branch sites at all
+ *
+ * Such a block only falls through into its layout successor, so neither the taken path nor the skip
+ * lanes need to go through the trampoline for it. This bounds the hops on skip paths by the number of
+ * skipped branch sites instead of the number of skipped blocks.
+ *
+ * @param MBB The block to check
+ * @param fallThrough The original fallthrough of MBB
+ * @param next The block following MBB in the layout
+ * @return true if MBB can fall through directly
+ */
+bool X86BranchConversion::isSiteless(const MachineBasicBlock &MBB, const MachineBasicBlock *fallThrough,
+                                     const MachineBasicBlock *next) {
+  if (fallThrough == nullptr || fallThrough != next || MBB.isReturnBlock())
+    return false;
+
+  for (auto &MI : MBB)
+    if (MI.isBranch() || MI.isReturn())
+      return false;
+
+  return true;
+}
+
+/**
+ * @brief get the location of the branch that converting MBB replaces
+ *
+ * Everything inserted for the branch carries this location, so profiles and the symbolizer attribute the
+ * trampolines and fake blocks to the source branch they stand for. A block without a branch stands for
+ * the fall through after its last instruction. Of a Jcc + JMP pair, the Jcc is converted in MBB, the JMP
+ * keeps its own location in the block split off for it.
+ *
+ * @param MBB The block being converted
+ * @return the location of the first terminator, or of the last instruction if there is none
+ */
+DebugLoc X86BranchConversion::getBranchLoc(const MachineBasicBlock &MBB) {
+  auto term = MBB.getFirstTerminator();
+  if (term != MBB.end())
+    return term->getDebugLoc();
+
+  for (auto iter = MBB.rbegin(); iter != MBB.rend(); ++iter)
+    if (!iter->isDebugValue())
+      return iter->getDebugLoc();
+  return DebugLoc();
+}
+
+/**
+ * @brief leave a non-secret conditional branch as a native jump
+ *
+ * The taken path jumps directly to its target, which is fine since targets do not rely on arriving
+ * through a lane. The fallthrough path continues through the trampoline like a block without a branch,
+ * so the lanes skipping over this block still find its fake block.
+ *
+ * @return true
+ */
+bool X86BranchConversion::keepConditionalBranch(MachineFunction &MF, MachineBasicBlock &MBB,
+                                                MachineInstrBundleIterator<MachineInstr, false> iter,
+                                                struct blockLane *takenLane, uint64_t fallThroughFreq) {
+  BC_DEBUG(dump_MI_with_operands("non-secret conditional branch", &*iter));
+
+  auto zbN_p1 = CreateNewBBonTrampoline(MBB, MF, nullptr, fallThroughFreq);
+  updateLane(takenLane, zbN_p1, nullptr, true, fallThroughFreq);
+
+  // LEA does not touch EFLAGS, so it can go in front of the Jcc
+  countBytes(BuildMI(MBB, iter, branchLoc, TII->get(X86::LEA64r), targetReg)
+                 .addReg(X86::RIP)
+                 .addImm(0)
+                 .addReg(0)
+                 .addMBB(zbN_p1)
+                 .addReg(0));
+  ++stats.keptCondBranches;
+  routeThroughFakeBlock(MBB, false);
+
+  return true;
+}
+
+void X86BranchConversion::addDummyInstructions(MachineBasicBlock *realBlock, MachineBasicBlock *trampolineBlock,
+                                               const DebugLoc &DL) {
+  if (DummyPadding == PM_Latency) {
+    addLatencyPadding(realBlock, trampolineBlock, DL);
+    return;
+  }
 
   int instructionCount = 0;
 
@@ -506,47 +1836,563 @@ void X86BranchConversion::addDummyInstructions(MachineBasicBlock *realBlock, Mac
     instructionCount++;
   }
 
+  // The padding is placed in front of the hop over realBlock, so the target register is still free there.
+  // Shared padding follows the LEA of the hop instead, which adding zero leaves intact.
+  unsigned padReg = TRI->getSubReg(targetReg, X86::sub_8bit);
+
   //const Constant *C = ConstantInt::get(Type::getInt8Ty(realBlock->getBasicBlock()->getContext()), 0);
   for (int i = 2; i < instructionCount; i++) {
-    BuildMI(trampolineBlock, DebugLoc(), TII->get(X86::ADD8ri), tmpReg8).addReg(tmpReg8).addImm(0);
+    countBytes(BuildMI(trampolineBlock, DL, TII->get(X86::ADD8ri), padReg).addReg(padReg).addImm(0));
   }
 }
 
+/**
+ * @brief end a fake block with the indirect jump to the selected trampoline
+ *
+ * With -x86-bc-dispatch-region, the fake blocks of up to that many consecutive blocks share a single
+ * indirect jump per target register. The first fake block of a region falls through into the shared
+ * dispatcher, the others reach it with a direct jump. Skip lanes still hop through the fake block of
+ * every block, so both paths take the same direct jump before the shared indirect one. This trades a
+ * direct jump per block for fewer indirect jump sites, i.e., BTB entries that each see the targets of
+ * a whole region. Pre-layout mode keeps one indirect jump per block.
+ *
+ * @param MF The function
+ * @param fakeBlock The new, empty fake block
+ */
+void X86BranchConversion::addFakeBlockJump(MachineFunction &MF, MachineBasicBlock *fakeBlock) {
+  if (DispatchRegion == 0 || preLayout) {
+    countBytes(BuildMI(fakeBlock, branchLoc, TII->get(X86::BC_JMP64r)).addReg(targetReg));
+    return;
+  }
+
+  auto &dispatcher = dispatchers[targetReg];
+  if (dispatcher.first != nullptr && dispatcher.second != 0) {
+    --dispatcher.second;
+    countBytes(BuildMI(fakeBlock, branchLoc, TII->get(getJumpOpcode())).addMBB(dispatcher.first));
+    fakeBlock->addSuccessor(dispatcher.first);
+    return;
+  }
+
+  auto dispatchBlock = MF.CreateMachineBasicBlock();
+  MF.insert(std::next(fakeBlock->getIterator()), dispatchBlock);
+  countBytes(BuildMI(dispatchBlock, branchLoc, TII->get(X86::BC_JMP64r)).addReg(targetReg));
+  fakeBlock->addSuccessor(dispatchBlock);
+  createdBlocks.push_back(dispatchBlock);
+  dispatcher = std::make_pair(dispatchBlock, DispatchRegion - 1);
+  ++stats.dispatchers;
+}
+
+/**
+ * @brief create the padded trampoline that all skip lanes hopping over MBB pass through
+ *
+ * The count padding only depends on the skipped block, so every hop over it would carry an identical
+ * copy. With -x86-bc-share-padding, the hops instead load the address of their next trampoline and
+ * jump to a single padded trampoline, which continues to the fake block. Every hop takes this detour,
+ * even a lone one or one over a block without padding, so all hops in the function execute the same
+ * two direct jumps before the indirect one. The taken path is unchanged. The latency padding clobbers
+ * the target register and cannot be shared this way.
+ *
+ * @param MBB The block the skip lanes hop over
+ * @param MF The function
+ * @param fakeBlock The fake block of MBB
+ * @return the shared padded trampoline, or nullptr if the hops carry their own padding
+ */
+MachineBasicBlock *X86BranchConversion::createSharedPadding(MachineBasicBlock &MBB, MachineFunction &MF,
+                                                            MachineBasicBlock *fakeBlock) {
+  if (!SharePadding || !EnableBBDummyInstr || DummyPadding != PM_Count)
+    return nullptr;
+
+  // Only a block that is actually hopped over needs the padded trampoline
+  if (llvm::none_of(lanes, [&](const struct blockLane *lane) {
+        return !lane->taken && lane->DestMBB != &MBB && lane->currentMBB != nullptr;
+      }))
+    return nullptr;
+
+  auto padBlock = CreateNewBBonTrampoline(MBB, MF, nullptr, 0);
+  addDummyInstructions(&MBB, padBlock, branchLoc);
+  countBytes(BuildMI(padBlock, branchLoc, TII->get(getJumpOpcode())).addMBB(fakeBlock));
+  padBlock->addSuccessor(fakeBlock);
+  ++stats.sharedPaddings;
+  return padBlock;
+}
+
+/**
+ * @brief pad a skip trampoline so that hopping over realBlock takes about as long as executing it
+ *
+ * The padding is a chain of dependent instructions on the target register, which is free in front of
+ * the hop. Each step picks the instruction with the most cycles per byte that still fits into the
+ * remaining cycles, so the chain reaches the estimate with the fewest bytes. None of the candidates
+ * touches EFLAGS, which may be live across the hop.
+ *
+ * @param realBlock The block being skipped
+ * @param trampolineBlock The skip trampoline to pad
+ * @param DL The location of the branch whose lane hops over realBlock
+ */
+void X86BranchConversion::addLatencyPadding(MachineBasicBlock *realBlock, MachineBasicBlock *trampolineBlock,
+                                            const DebugLoc &DL) {
+  auto it = blockCycles.find(realBlock);
+  if (it == blockCycles.end())
+    it = blockCycles.insert(std::make_pair(realBlock, estimateBlockCycles(*realBlock))).first;
+  unsigned remaining = it->second;
+
+  struct candidate {
+    unsigned opcode;
+    unsigned reg;
+    unsigned latency;
+    unsigned size;
+  };
+  unsigned padReg32 = TRI->getSubReg(targetReg, X86::sub_32bit);
+  candidate candidates[] = {{X86::NOT32r, padReg32, 0, 0},
+                            {X86::BSWAP32r, padReg32, 0, 0},
+                            {X86::BSWAP64r, targetReg, 0, 0},
+                            {X86::LEA64r, targetReg, 0, 0}};
+  for (auto &c : candidates) {
+    c.latency = schedModel.computeInstrLatency(c.opcode);
+    c.size = paddingSize(c.opcode, c.reg);
+  }
+
+  // The target register is not defined yet in front of the hop, so the chain starts from an undef read
+  unsigned useFlags = RegState::Undef;
+  while (remaining > 0) {
+    const candidate *best = nullptr;
+    for (auto &c : candidates)
+      if (c.latency > 0 && c.latency <= remaining &&
+          (best == nullptr || c.latency * best->size > best->latency * c.size))
+        best = &c;
+    if (best == nullptr)
+      break;
+
+    auto MIB = BuildMI(trampolineBlock, DL, TII->get(best->opcode), best->reg);
+    if (best->opcode == X86::LEA64r)
+      MIB.addReg(targetReg, useFlags).addImm(1).addReg(targetReg, useFlags).addImm(0).addReg(0);
+    else
+      MIB.addReg(best->reg, useFlags);
+    countBytes(MIB);
+
+    remaining -= best->latency;
+    useFlags = 0;
+  }
+}
+
+/**
+ * @brief estimate the cycles needed to execute the body of MBB with the scheduling model
+ *
+ * This is the longer of the critical path through the register dependencies of the block and the time
+ * needed to issue all of its micro-ops. Memory dependencies and the terminators are ignored.
+ *
+ * @param MBB The block to estimate
+ * @return the estimated number of cycles
+ */
+unsigned X86BranchConversion::estimateBlockCycles(const MachineBasicBlock &MBB) const {
+  DenseMap<unsigned, unsigned> readyAt; // cycle at which each register unit written by the block is ready
+  unsigned criticalPath = 0;
+  unsigned uops = 0;
+
+  for (auto &MI : MBB) {
+    if (MI.isTerminator())
+      break;
+    if (MI.isDebugValue() || MI.isCFIInstruction() || MI.isKill() || MI.isImplicitDef())
+      continue;
+
+    unsigned start = 0;
+    for (auto &op : MI.operands())
+      if (op.isReg() && op.getReg() != 0 && op.readsReg())
+        for (MCRegUnitIterator unit(op.getReg(), TRI); unit.isValid(); ++unit)
+          start = std::max(start, readyAt.lookup(*unit));
+
+    unsigned done = start + schedModel.computeInstrLatency(&MI);
+    for (auto &op : MI.operands())
+      if (op.isReg() && op.getReg() != 0 && op.isDef())
+        for (MCRegUnitIterator unit(op.getReg(), TRI); unit.isValid(); ++unit)
+          readyAt[*unit] = done;
+
+    criticalPath = std::max(criticalPath, done);
+    uops += schedModel.getNumMicroOps(&MI);
+  }
+
+  unsigned issueWidth = std::max(1u, schedModel.getIssueWidth());
+  return std::max(criticalPath, (uops + issueWidth - 1) / issueWidth);
+}
+
+void X86BranchConversion::collectLiveOuts(MachineFunction &MF) {
+  if (BranchConversionReserveRegs)
+    return;
+
+  if (!MRI->tracksLiveness())
+    report_fatal_error("branch conversion requires register liveness in " + MF.getName() +
+                       ", use -x86-bc-reserve-regs instead");
+
+  LiveRegUnits liveOuts(*TRI);
+  for (auto &MBB : MF) {
+    liveOuts.clear();
+    liveOuts.addLiveOuts(MBB);
+    liveOutUnits[&MBB] = liveOuts.getBitVector();
+  }
+}
+
+/**
+ * @brief select the scratch registers used for converting MBB
+ *
+ * The target register is written at the end of MBB and read by its fake block, and is also written by
+ * every skip lane hopping over MBB. It must therefore be free at the end of MBB and at the start of the
+ * destination of each such lane. Callee-saved registers are only used if the prologue already saves
+ * them, unsaved ones are part of the (pristine) live-outs.
+ *
+ * @param MBB The block about to be converted
+ */
+void X86BranchConversion::selectScratchRegs(MachineBasicBlock &MBB) {
+  if (BranchConversionReserveRegs) {
+    targetReg = X86::R11;
+    tmpReg = X86::R10;
+    return;
+  }
+
+  LiveRegUnits busy(*TRI);
+  auto it = liveOutUnits.find(&MBB);
+  if (it != liveOutUnits.end())
+    busy.addUnits(it->second);
+  else
+    busy.addLiveOuts(MBB);
+
+  // Our instructions go in front of the terminators, so whatever they read is busy as well
+  for (auto &MI : MBB.terminators())
+    for (auto &op : MI.operands())
+      if (op.isReg() && op.getReg() != 0 && op.readsReg())
+        busy.addReg(op.getReg());
+
+  for (auto *lane : lanes)
+    if (!lane->taken && lane->currentMBB != nullptr && lane->DestMBB != nullptr && lane->DestMBB != &MBB)
+      busy.addLiveIns(*lane->DestMBB);
+
+  targetReg = tmpReg = X86::NoRegister;
+  for (auto reg : scratchCandidates) {
+    if (MRI->isReserved(reg) || !busy.available(reg))
+      continue;
+    if (targetReg == X86::NoRegister) {
+      targetReg = reg;
+    } else {
+      tmpReg = reg;
+      break;
+    }
+  }
+
+  if (targetReg == X86::NoRegister)
+    report_fatal_error("branch conversion found no free scratch register in " + MBB.getParent()->getName() +
+                       ", use -x86-bc-reserve-regs instead");
+}
+
+void X86BranchConversion::requireTmpReg(const MachineBasicBlock &MBB) const {
+  if (tmpReg == X86::NoRegister)
+    report_fatal_error("branch conversion found no second scratch register for a conditional branch in " +
+                       MBB.getParent()->getName() + ", use -x86-bc-reserve-regs instead");
+}
+
+/**
+ * @brief estimate the encoded size of an instruction inserted by the pass
+ *
+ * There is no size information for X86 instructions before they are lowered to MC, so this assumes
+ * 32-bit displacements and the REX prefixes of the registers involved.
+ *
+ * @param MI The instruction to estimate
+ * @return the estimated size in bytes
+ */
+unsigned X86BranchConversion::estimateSize(const MachineInstr &MI) {
+  auto rex = [&MI](unsigned idx) {
+    return MI.getOperand(idx).isReg() && X86II::isX86_64ExtendedReg(MI.getOperand(idx).getReg()) ? 1 : 0;
+  };
+  // SPL, BPL, SIL and DIL are only addressable with a REX prefix as well
+  auto byteRex = [&MI, &rex](unsigned idx) {
+    return rex(idx) || X86II::isX86_64NonExtLowByteReg(MI.getOperand(idx).getReg()) ? 1 : 0;
+  };
+
+  if (X86::getCondFromSETOpc(MI.getOpcode()) != X86::COND_INVALID)
+    return 3 + byteRex(0);
+
+  switch (MI.getOpcode()) {
+  case X86::JMP_1:
+    return 2; // relaxed to 5 bytes if the target is out of range
+  case X86::JMP_4:
+    return 5;
+  case X86::BC_JMP64r:
+    return 2 + rex(0);
+  case X86::LEA64r:
+    if (MI.getOperand(1).getReg() == X86::RIP)
+      return 7; // REX.W, opcode, ModRM and disp32
+    return paddingSize(MI.getOpcode(), MI.getOperand(1).getReg()); // the base decides about the disp8
+  case X86::NOT32r:
+  case X86::BSWAP32r:
+  case X86::BSWAP64r:
+    return paddingSize(MI.getOpcode(), MI.getOperand(0).getReg());
+  case X86::MOVZX32rr8:
+    return 3 + (rex(0) || byteRex(1) ? 1 : 0);
+  case X86::OR8rr:
+    return 2 + (byteRex(0) || byteRex(2) ? 1 : 0);
+  case X86::MOV64rr:
+    return 3;
+  case X86::MOV64rm:
+    return 8; // REX.W, opcode, ModRM, SIB and disp32
+  case X86::ADD8ri:
+    return 3 + rex(0);
+  default:
+    return 4; // CMOVcc: REX.W, two opcode bytes and ModRM
+  }
+}
+
+/**
+ * @brief get the encoded size of a padding instruction operating on reg
+ *
+ * @param opcode The padding opcode, see addLatencyPadding
+ * @param reg The register it operates on
+ * @return the size in bytes
+ */
+unsigned X86BranchConversion::paddingSize(unsigned opcode, unsigned reg) {
+  unsigned rex = X86II::isX86_64ExtendedReg(reg) ? 1 : 0;
+  switch (opcode) {
+  case X86::NOT32r:
+  case X86::BSWAP32r:
+    return 2 + rex;
+  case X86::BSWAP64r:
+    return 3;
+  case X86::LEA64r:
+    // REX.W, opcode, ModRM and SIB for [reg + reg], RBP and R13 bases need a zero disp8
+    return (reg == X86::RBP || reg == X86::R13) ? 5 : 4;
+  default:
+    llvm_unreachable("not a padding instruction");
+  }
+}
+
+inline const MachineInstrBuilder &X86BranchConversion::countBytes(const MachineInstrBuilder &MIB) {
+  stats.bytes += estimateSize(*MIB);
+  return MIB;
+}
+
+/**
+ * @brief update the statistics and emit the optimization remark summarizing the conversion of MF
+ *
+ * The remark carries all counts as arguments, so -pass-remarks-output files can be compared between
+ * builds per function.
+ *
+ * @param MF The converted machine function
+ * @param entry The original entry block
+ */
+void X86BranchConversion::reportStats(MachineFunction &MF, MachineBasicBlock &entry) {
+  ++NumFunctionsConverted;
+  NumCondBranchesConverted += stats.condBranches;
+  NumCondBranchesKept += stats.keptCondBranches;
+  NumCondBranchesSetcc += stats.setccCondBranches;
+  NumCondBranchesFused += stats.fusedCondBranches;
+  NumJumpsConverted += stats.jumps;
+  NumIndirectJumpsConverted += stats.indirectJumps;
+  NumFallThroughsConverted += stats.fallThroughs;
+  NumTrampolineBlocks += stats.trampolines;
+  NumSkipHops += stats.skipHops;
+  NumSharedPaddings += stats.sharedPaddings;
+  NumDispatchers += stats.dispatchers;
+  NumBytesAdded += stats.bytes;
+
+  ORE->emit([&]() {
+    return MachineOptimizationRemark(DEBUG_TYPE, "Converted", MF.getFunction().getSubprogram(), &entry)
+           << "converted " << ore::NV("CondBranches", stats.condBranches) << " conditional branches, "
+           << ore::NV("Jumps", stats.jumps) << " jumps, "
+           << ore::NV("IndirectJumps", stats.indirectJumps) << " indirect jumps and "
+           << ore::NV("FallThroughs", stats.fallThroughs) << " fall-throughs (kept "
+           << ore::NV("KeptCondBranches", stats.keptCondBranches) << " conditional branches) using "
+           << ore::NV("Trampolines", stats.trampolines) << " trampoline blocks, "
+           << ore::NV("SkipHops", stats.skipHops) << " skip hops and about "
+           << ore::NV("BytesAdded", stats.bytes) << " bytes of code";
+  });
+}
+
+/**
+ * @brief estimate the cost of one invocation of MF with the scheduling model
+ *
+ * Each block contributes the latencies and micro-ops of its instructions, weighted by its frequency
+ * relative to the entry. After conversion, the blocks we created use the frequencies of the lanes
+ * passing through them.
+ *
+ * @param MF The machine function to estimate
+ * @param converted Whether MF already contains trampolines
+ * @return the estimated cost per invocation
+ */
+executionCost X86BranchConversion::estimateCost(const MachineFunction &MF, bool converted) const {
+  executionCost cost;
+  if (entryFreq == 0)
+    return cost;
+
+  for (auto &MBB : MF) {
+    auto it = blockFreqs.find(&MBB);
+    uint64_t freq = it != blockFreqs.end() ? it->second : (converted ? trampolineFreqs.lookup(&MBB) : 0);
+    if (freq == 0)
+      continue;
+
+    double weight = (double)freq / entryFreq;
+    for (auto &MI : MBB) {
+      if (MI.isDebugValue() || MI.isCFIInstruction() || MI.isKill() || MI.isImplicitDef())
+        continue;
+      cost.cycles += weight * schedModel.computeInstrLatency(&MI);
+      cost.uops += weight * schedModel.getNumMicroOps(&MI);
+    }
+  }
+
+  return cost;
+}
+
+/**
+ * @brief report the estimated overhead of the conversion of MF and check it against the budget
+ *
+ * @param MF The converted machine function
+ * @param entry The original entry block
+ */
+void X86BranchConversion::reportOverhead(MachineFunction &MF, MachineBasicBlock &entry) {
+  executionCost costAfter = estimateCost(MF, true);
+
+  auto fmt = [](double value) {
+    std::string str;
+    raw_string_ostream os(str);
+    os << format("%.2f", value);
+    return os.str();
+  };
+
+  ORE->emit([&]() {
+    return MachineOptimizationRemarkAnalysis(DEBUG_TYPE, "Overhead", MF.getFunction().getSubprogram(), &entry)
+           << "estimated cycles " << ore::NV("CyclesBefore", fmt(costBefore.cycles)) << " -> "
+           << ore::NV("CyclesAfter", fmt(costAfter.cycles)) << ", uops "
+           << ore::NV("UopsBefore", fmt(costBefore.uops)) << " -> "
+           << ore::NV("UopsAfter", fmt(costAfter.uops)) << ", "
+           << ore::NV("BytesAdded", stats.bytes) << " bytes added";
+  });
+
+  if (OverheadBudget == 0 || costBefore.cycles <= 0)
+    return;
+
+  uint64_t overhead = (uint64_t)(100 * (costAfter.cycles - costBefore.cycles) / costBefore.cycles);
+  if (overhead > OverheadBudget) {
+    DiagnosticInfoResourceLimit diag(MF.getFunction(), "branch conversion cycle overhead percentage", overhead,
+                                     DS_Warning, DK_ResourceLimit, OverheadBudget);
+    MF.getFunction().getContext().diagnose(diag);
+  }
+}
+
+/**
+ * @brief find where to put the trampolines of a loop back-edge
+ *
+ * A branch from inside a loop to its header gets its trampolines right after the fake block of the
+ * branching block. The back-edge then takes one hop through a trampoline next to the loop, just like
+ * the exit path, instead of a round trip to the trampoline region in front of the function. The first
+ * fake block of a dispatch region falls through into the shared dispatcher, so there the trampolines
+ * go after the dispatcher instead.
+ *
+ * @param MBB The block containing the branch
+ * @param dstMBB The target of the branch
+ * @return the block to insert the trampolines after, or nullptr to use the trampoline region
+ */
+MachineBasicBlock *X86BranchConversion::getLoopTrampolinePos(MachineBasicBlock &MBB,
+                                                             const MachineBasicBlock *dstMBB) const {
+  if (MLI == nullptr || !isProcessed(dstMBB))
+    return nullptr;
+
+  const MachineLoop *loop = MLI->getLoopFor(dstMBB);
+  if (loop == nullptr || loop->getHeader() != dstMBB || !loop->contains(&MBB))
+    return nullptr;
+
+  // The fake block of MBB ends in a jump, unless it falls through into a new dispatcher
+  MachineBasicBlock *fakeBlock = MBB.getNextNode();
+  assert(fakeBlock != nullptr && fakeBlock->getBasicBlock() == nullptr && "expected the fake block of MBB");
+  MachineBasicBlock *pos = fakeBlock;
+  if (pos->empty() || !pos->back().isBarrier())
+    pos = pos->getNextNode();
+  assert(pos != nullptr && !pos->empty() && pos->back().isBarrier() && "trampolines must not be fallen into");
+  return pos;
+}
+
 MachineBasicBlock *X86BranchConversion::CreateNewBBonTrampoline(MachineBasicBlock &MBB, MachineFunction &MF,
-                                                                MachineBasicBlock *destOnCode) {
+                                                                MachineBasicBlock *destOnCode,
+                                                                uint64_t freq, MachineBasicBlock *after) {
   MachineBasicBlock *newBlock = MF.CreateMachineBasicBlock();
-  MF.push_front(newBlock);
+  if (after != nullptr)
+    MF.insert(std::next(after->getIterator()), newBlock);
+  else
+    MF.push_front(newBlock);
+  ++stats.trampolines;
+  createdBlocks.push_back(newBlock);
+  // Only referenced by LEAs (or jump tables), which branch folding would not update when removing the block
+  if (preLayout)
+    newBlock->setHasAddressTaken();
+  // Not in pre-layout mode, where block placement and branch folding may still drop the block
+  if (TrampolineSymbols && !preLayout && TM->getTargetTriple().isOSBinFormatELF())
+    MF.getInfo<X86MachineFunctionInfo>()->addTrampolineSymbol(newBlock);
+  if (tracksFrequencies())
+    trampolineFreqs[newBlock] = freq;
   if (destOnCode != nullptr) {
     BC_DEBUG(errs() << "\t\t\t" << "we create a block on Trampoline, that is a jump from: ");
     BC_DEBUG(errs() << newBlock << " to: " << destOnCode << "\n");
     LANE_DEBUG(errs() << "!!! updating lane to ");
     LANE_DEBUG(errs().write_escaped(destOnCode->getName()) << "\n");
-    BuildMI(newBlock, DebugLoc(), TII->get(X86::JMP_4)).addMBB(destOnCode);
+    countBytes(BuildMI(newBlock, branchLoc, TII->get(getJumpOpcode())).addMBB(destOnCode));
     newBlock->addSuccessor(destOnCode);
   }
 
   //MBB.setHasAddressTaken();
-  MBB.addSuccessor(newBlock);
+  if (preLayout && currentFakeBlock != nullptr)
+    addFakeBlockSuccessor(newBlock, freq);
+  else
+    MBB.addSuccessor(newBlock);
   return newBlock;
 }
 
 struct blockLane *X86BranchConversion::addBBtoBlockLane(MachineBasicBlock *MBB,
                                                         MachineBasicBlock *DestMBB,
-                                                        bool taken) {
-  auto newLane = new blockLane(MBB, DestMBB, taken);
-  takenBlocks->push_back(newLane);
+                                                        bool taken,
+                                                        uint64_t freq) {
+  auto newLane = new (laneAllocator.Allocate<blockLane>()) blockLane(MBB, DestMBB, taken, freq, branchLoc);
+  lanes.push_back(newLane);
+  if (!taken && DestMBB != nullptr)
+    skipLaneByDest[DestMBB] = newLane;
   return newLane;
 }
 
 inline void
-X86BranchConversion::updateLane(struct blockLane *lane, MachineBasicBlock *a, MachineBasicBlock *b, bool c) {
+X86BranchConversion::updateLane(struct blockLane *lane, MachineBasicBlock *a, MachineBasicBlock *b, bool c,
+                                uint64_t freq) {
   if (lane != nullptr) {
     lane->currentMBB = a;
     lane->DestMBB = b;
     lane->taken = c;
+    lane->freq = freq;
+    lane->loc = branchLoc;
+    if (!c && b != nullptr)
+      skipLaneByDest[b] = lane;
   }
 }
 
+/**
+ * @brief look up the skip lane already heading to DestMBB, if any
+ *
+ * The lane was hopped over the current block before its terminator is converted, so its current
+ * trampoline block stands in for the next block, exactly like a freshly created one would. A new
+ * source can therefore use it directly instead of starting a parallel chain.
+ *
+ * @param DestMBB The destination of the new source
+ * @param freq The frequency of the new source, added to the shared lane
+ * @return the shared lane, or nullptr if there is none
+ */
+struct blockLane *X86BranchConversion::joinSkipLane(MachineBasicBlock *DestMBB, uint64_t freq) {
+  auto lane = skipLaneByDest.lookup(DestMBB);
+  if (lane == nullptr || lane->currentMBB == nullptr)
+    return nullptr;
+
+  lane->freq += freq;
+  if (tracksFrequencies())
+    trampolineFreqs[lane->currentMBB] += freq;
+
+  return lane;
+}
+
+inline bool X86BranchConversion::isProcessed(const MachineBasicBlock *MBB) const {
+  unsigned num = MBB->getNumber();
+  return num < processedMBBs.size() && processedMBBs.test(num);
+}
+
 unsigned int X86BranchConversion::getCorrespondingMovOpcode(MachineInstr &MI) {
   X86::CondCode CC = X86::getCondFromBranchOpc(MI.getOpcode());
   return X86::getCMovFromCond(CC, 8, false);
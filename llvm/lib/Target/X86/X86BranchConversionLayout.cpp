@@ -0,0 +1,164 @@
+//===-X86BranchConversionLayout.cpp-Whole-module order of converted code--===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// Copyright: Secure Systems Group, Aalto University https://ssg.aalto.fi/
+//===----------------------------------------------------------------------===//
+//
+// Branch conversion works on one machine function at a time, so on its own it
+// cannot tell which trampolines run together. Run on the merged module of LTO,
+// or on a ThinLTO backend module, this pass orders the functions that branch
+// conversion converts by the call graph and the profile: the converted
+// functions no other converted function calls come first, hottest first, and
+// every function is followed by its hottest converted callees, depth first. The
+// converted functions move to the end of the module in this order, the other
+// functions keep theirs.
+//
+// Functions are emitted in module order, so with all trampolines in one
+// section (see -x86-bc-trampoline-section, which the whole-program layout
+// defaults to .text.bcv_tramp) the trampolines of callers and callees end up
+// next to each other, and the functions need no jump over their trampolines.
+//
+//===----------------------------------------------------------------------===//
+
+#include "X86.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "x86-bc-layout"
+
+STATISTIC(NumOrderedFunctions, "Number of converted functions ordered by the whole-program layout");
+
+namespace {
+
+class X86BranchConversionLayout : public ModulePass {
+public:
+  static char ID;
+
+  X86BranchConversionLayout() : ModulePass(ID) {}
+
+  StringRef getPassName() const override { return "X86 Branch Conversion Layout"; }
+
+  bool runOnModule(Module &M) override;
+
+private:
+  void visit(Function *F);
+
+  DenseMap<const Function *, SmallVector<Function *, 4>> callees;
+
+  SmallPtrSet<const Function *, 32> called;
+
+  SmallPtrSet<const Function *, 32> visited;
+
+  SmallVector<Function *, 32> order;
+};
+
+} // end anonymous namespace
+
+ModulePass *llvm::createX86BranchConversionLayoutPass() { return new X86BranchConversionLayout(); }
+
+char X86BranchConversionLayout::ID = 0;
+
+/**
+ * @brief get the profiled entry count of F
+ *
+ * @param F The function to look up
+ * @return the entry count, or 0 if F has no profile
+ */
+static uint64_t getEntryCount(const Function *F) {
+  auto count = F->getEntryCount();
+  return count.hasValue() ? *count : 0;
+}
+
+/**
+ * @brief sort functions by their entry count, keeping the module order among equally hot ones
+ *
+ * @param functions The functions to sort
+ */
+static void sortByEntryCount(SmallVectorImpl<Function *> &functions) {
+  std::stable_sort(functions.begin(), functions.end(), [](const Function *a, const Function *b) {
+    return getEntryCount(a) > getEntryCount(b);
+  });
+}
+
+bool X86BranchConversionLayout::runOnModule(Module &M) {
+  SmallVector<Function *, 32> converted;
+  for (auto &F : M)
+    if (!F.isDeclaration() && isBranchConversionEnabled(F))
+      converted.push_back(&F);
+
+  if (converted.size() < 2)
+    return false;
+
+  for (auto *F : converted) {
+    auto &calls = callees[F];
+    for (auto &I : instructions(*F)) {
+      CallSite CS(&I);
+      auto *callee = CS ? CS.getCalledFunction() : nullptr;
+      if (callee != nullptr && callee != F && !callee->isDeclaration() &&
+          isBranchConversionEnabled(*callee) && std::find(calls.begin(), calls.end(), callee) == calls.end())
+        calls.push_back(callee);
+    }
+    sortByEntryCount(calls);
+    called.insert(calls.begin(), calls.end());
+  }
+
+  SmallVector<Function *, 32> roots;
+  for (auto *F : converted)
+    if (!called.count(F))
+      roots.push_back(F);
+
+  sortByEntryCount(roots);
+  for (auto *F : roots)
+    visit(F);
+  // Whatever is left is only reachable through cycles of converted functions
+  sortByEntryCount(converted);
+  for (auto *F : converted)
+    visit(F);
+
+  auto &functions = M.getFunctionList();
+  for (auto *F : order)
+    functions.splice(functions.end(), functions, F->getIterator());
+
+  NumOrderedFunctions += order.size();
+  DEBUG(dbgs() << getPassName() << ": ordered " << order.size() << " converted functions\n");
+
+  callees.clear();
+  called.clear();
+  visited.clear();
+  order.clear();
+  return true;
+}
+
+/**
+ * @brief append F and, depth first, the converted functions it calls to the order
+ *
+ * @param F The function to visit
+ */
+void X86BranchConversionLayout::visit(Function *F) {
+  SmallVector<Function *, 16> worklist;
+  worklist.push_back(F);
+
+  while (!worklist.empty()) {
+    auto *next = worklist.pop_back_val();
+    if (!visited.insert(next).second)
+      continue;
+
+    order.push_back(next);
+    // The hottest callee comes right after its caller, so it has to be popped first
+    auto &calls = callees[next];
+    worklist.append(calls.rbegin(), calls.rend());
+  }
+}
@@ -0,0 +1,237 @@
+//===-X86BranchConversionMultiversion.cpp-Native clones of converted code--===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// Copyright: Secure Systems Group, Aalto University https://ssg.aalto.fi/
+//===----------------------------------------------------------------------===//
+//
+// This pass gives functions that branch conversion would convert a second,
+// native clone named <function>.bcv.native, which carries the
+// "no-branch-shadow-protect" attribute. Direct call sites then pick one of the
+// two versions, so that code that never touches secrets does not pay for the
+// trampolines:
+//  - flag: every call site loads the __bcv_protect global and calls the
+//    original if it is non-zero and the native clone otherwise. The global is
+//    defined weak with the value 1, so the enclave can provide its own
+//    definition and switch modes at run time. The dispatch is a select, i.e.,
+//    a CMOV and an indirect call in converted code.
+//  - context: call sites in functions that are not converted call native
+//    clones, all other call sites keep calling the converted original. Only
+//    protected contexts therefore reach protected code, without any dispatch
+//    at run time.
+//
+// The original keeps its name and linkage, so callers outside the module and
+// indirect calls always reach the protected version. Interposable functions
+// and functions with the "no-branch-shadow-multiversion" attribute are not
+// cloned.
+//
+//===----------------------------------------------------------------------===//
+
+#include "X86.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+#include <map>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "x86-bc-multiversion"
+
+STATISTIC(NumNativeClones, "Number of native clones of converted functions");
+STATISTIC(NumDispatchedCalls, "Number of call sites dispatching on the protection flag");
+STATISTIC(NumNativeCalls, "Number of call sites redirected to native clones");
+
+namespace {
+
+static constexpr const char *protectFlagName = "__bcv_protect";
+static constexpr const char *nativeSuffix = ".bcv.native";
+
+class X86BranchConversionMultiversion : public ModulePass {
+public:
+  static char ID;
+
+  explicit X86BranchConversionMultiversion(BranchConversionDispatch dispatch)
+      : ModulePass(ID), dispatch(dispatch) {}
+
+  StringRef getPassName() const override { return "X86 Branch Conversion Multiversioning"; }
+
+  bool runOnModule(Module &M) override;
+
+private:
+  bool dispatchOnFlag(Module &M);
+
+  bool dispatchOnContext(Module &M);
+
+  bool isEligible(const Function &F) const;
+
+  Function *getNativeClone(Function &F);
+
+  GlobalVariable *getProtectFlag(Module &M);
+
+  BranchConversionDispatch dispatch;
+
+  std::map<const Function *, Function *> nativeClones;
+};
+
+} // end anonymous namespace
+
+ModulePass *llvm::createX86BranchConversionMultiversionPass(BranchConversionDispatch Dispatch) {
+  return new X86BranchConversionMultiversion(Dispatch);
+}
+
+char X86BranchConversionMultiversion::ID = 0;
+
+bool X86BranchConversionMultiversion::runOnModule(Module &M) {
+  bool modified = false;
+
+  switch (dispatch) {
+  case BranchConversionDispatch::None:
+    break;
+  case BranchConversionDispatch::Flag:
+    modified = dispatchOnFlag(M);
+    break;
+  case BranchConversionDispatch::Context:
+    modified = dispatchOnContext(M);
+    break;
+  }
+
+  DEBUG(dbgs() << getPassName() << ": " << nativeClones.size() << " native clones\n");
+
+  nativeClones.clear();
+  return modified;
+}
+
+/**
+ * @brief let every direct call to an eligible function choose its version from the protection flag
+ *
+ * @param M The module to process
+ * @return true if the module was modified
+ */
+bool X86BranchConversionMultiversion::dispatchOnFlag(Module &M) {
+  // Clone first, so that the call sites copied into the clones are dispatched as well
+  SmallVector<Function *, 16> callees;
+  for (auto &F : M)
+    for (auto &I : instructions(F)) {
+      CallSite CS(&I);
+      if (CS && CS.getCalledFunction() != nullptr && isEligible(*CS.getCalledFunction()))
+        callees.push_back(CS.getCalledFunction());
+    }
+
+  if (callees.empty())
+    return false;
+
+  for (auto *callee : callees)
+    getNativeClone(*callee);
+
+  SmallVector<CallSite, 32> calls;
+  for (auto &F : M)
+    for (auto &I : instructions(F)) {
+      CallSite CS(&I);
+      // A musttail call has to stay a direct call to a function of the same prototype, keep it protected
+      if (CS && !CS.isMustTailCall() && nativeClones.count(CS.getCalledFunction()))
+        calls.push_back(CS);
+    }
+
+  auto *flag = getProtectFlag(M);
+  for (auto CS : calls) {
+    auto *callee = CS.getCalledFunction();
+    IRBuilder<> IRB(CS.getInstruction());
+    auto *isProtected = IRB.CreateIsNotNull(IRB.CreateLoad(flag), "bcv.protect");
+    CS.setCalledFunction(IRB.CreateSelect(isProtected, callee, getNativeClone(*callee), callee->getName()));
+    ++NumDispatchedCalls;
+  }
+
+  return true;
+}
+
+/**
+ * @brief redirect the direct calls of unconverted functions to native clones
+ *
+ * The native clones are not converted either, so their calls are redirected in turn.
+ *
+ * @param M The module to process
+ * @return true if the module was modified
+ */
+bool X86BranchConversionMultiversion::dispatchOnContext(Module &M) {
+  SmallVector<Function *, 16> worklist;
+  for (auto &F : M)
+    if (!F.isDeclaration() && !isBranchConversionEnabled(F))
+      worklist.push_back(&F);
+
+  bool modified = false;
+  while (!worklist.empty()) {
+    auto *caller = worklist.pop_back_val();
+
+    for (auto &I : instructions(*caller)) {
+      CallSite CS(&I);
+      if (!CS || CS.getCalledFunction() == nullptr || !isEligible(*CS.getCalledFunction()))
+        continue;
+
+      auto *callee = CS.getCalledFunction();
+      bool isNew = !nativeClones.count(callee);
+      auto *clone = getNativeClone(*callee);
+      if (isNew)
+        worklist.push_back(clone);
+
+      CS.setCalledFunction(clone);
+      ++NumNativeCalls;
+      modified = true;
+    }
+  }
+
+  return modified;
+}
+
+/**
+ * @brief check whether F gets a native clone
+ *
+ * @param F The function to check
+ * @return true if F is converted and calls to it may be redirected to a clone
+ */
+bool X86BranchConversionMultiversion::isEligible(const Function &F) const {
+  if (F.isDeclaration() || F.isInterposable() || F.hasAvailableExternallyLinkage())
+    return false;
+  if (F.hasFnAttribute("no-branch-shadow-multiversion"))
+    return false;
+
+  return isBranchConversionEnabled(F);
+}
+
+Function *X86BranchConversionMultiversion::getNativeClone(Function &F) {
+  auto &clone = nativeClones[&F];
+  if (clone != nullptr)
+    return clone;
+
+  ValueToValueMapTy VMap;
+  clone = CloneFunction(&F, VMap);
+  clone->setName(F.getName() + nativeSuffix);
+  clone->setLinkage(GlobalValue::InternalLinkage);
+  clone->setVisibility(GlobalValue::DefaultVisibility);
+  clone->setDLLStorageClass(GlobalValue::DefaultStorageClass);
+  clone->setComdat(nullptr);
+  clone->removeFnAttr("branch-shadow-protect");
+  clone->addFnAttr("no-branch-shadow-protect");
+
+  ++NumNativeClones;
+  return clone;
+}
+
+GlobalVariable *X86BranchConversionMultiversion::getProtectFlag(Module &M) {
+  if (auto *GV = M.getNamedGlobal(protectFlagName))
+    return GV;
+
+  // Protected unless the enclave says otherwise
+  auto *int8 = Type::getInt8Ty(M.getContext());
+  return new GlobalVariable(M, int8, false, GlobalValue::WeakAnyLinkage, ConstantInt::get(int8, 1),
+                            protectFlagName);
+}
@@ -0,0 +1,85 @@
+//===-X86BranchConversionVerifier.cpp-Check converted functions after layout-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// Copyright: Secure Systems Group, Aalto University https://ssg.aalto.fi/
+//===----------------------------------------------------------------------===//
+//
+// With -x86-bc-pre-layout, branch conversion runs before block placement so
+// that the trampolines are laid out (and their jumps removed when they fall
+// through) like any other block. The layout passes may move, merge and drop
+// blocks, but every path through a converted block must still pass the same
+// single branch site, i.e., the jump of its fake block. This pass runs right
+// before emission and rejects functions where layout
+//  - duplicated a fake block jump, e.g., through tail duplication, or
+//  - added conditional branches, which would reveal the path taken.
+//
+//===----------------------------------------------------------------------===//
+
+#include "X86.h"
+#include "X86InstrInfo.h"
+#include "X86MachineFunctionInfo.h"
+#include "llvm/CodeGen/MachineFunction.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/ErrorHandling.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "x86-branch-conversion-verifier"
+
+namespace {
+
+class X86BranchConversionVerifier : public MachineFunctionPass {
+public:
+  static char ID;
+
+  X86BranchConversionVerifier() : MachineFunctionPass(ID) {}
+
+  StringRef getPassName() const override { return "X86 Branch Conversion Verifier"; }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.setPreservesAll();
+    MachineFunctionPass::getAnalysisUsage(AU);
+  }
+
+  bool runOnMachineFunction(MachineFunction &MF) override;
+};
+
+} // end anonymous namespace
+
+FunctionPass *llvm::createX86BranchConversionVerifierPass() {
+  return new X86BranchConversionVerifier();
+}
+
+char X86BranchConversionVerifier::ID = 0;
+
+bool X86BranchConversionVerifier::runOnMachineFunction(MachineFunction &MF) {
+  auto *MFI = MF.getInfo<X86MachineFunctionInfo>();
+  if (!MFI->isBranchConversionPreLayout())
+    return false;
+
+  unsigned sites = 0;
+  unsigned condBranches = 0;
+  for (auto &MBB : MF) {
+    for (auto &MI : MBB.terminators()) {
+      if (MI.getOpcode() == X86::BC_JMP64r)
+        ++sites;
+      else if (MI.isConditionalBranch())
+        ++condBranches;
+    }
+  }
+
+  DEBUG(dbgs() << getPassName() << ": " << MF.getName() << " has " << sites << " of "
+               << MFI->getNumBranchConversionSites() << " branch sites, " << condBranches << " of "
+               << MFI->getNumBranchConversionKeptBranches() << " conditional branches\n");
+
+  // Dropping unreachable fake blocks is fine, only new copies break the invariant
+  if (sites > MFI->getNumBranchConversionSites())
+    report_fatal_error("block placement duplicated a branch conversion site in " + MF.getName());
+  if (condBranches > MFI->getNumBranchConversionKeptBranches())
+    report_fatal_error("block placement added a conditional branch to the converted function " +
+                       MF.getName());
+
+  return false;
+}
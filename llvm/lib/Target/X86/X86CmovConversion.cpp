@@ -285,6 +285,10 @@ bool X86CmovConverterPass::collectCmovCandidates(
   CmovGroup Group;
   for (auto *MBB : Blocks) {
     Group.clear();
+    // Branch conversion would turn the branch back into a CMOV, behind an
+    // indirect jump through a trampoline pair
+    if (isBranchConverted(*MBB))
+      continue;
     // Condition code of first CMOV instruction current processed range and its
     // opposite condition code.
     X86::CondCode FirstCC, FirstOppCC, MemOpCC;
@@ -14,6 +14,7 @@
 
 #include "X86ISelLowering.h"
 #include "Utils/X86ShuffleDecode.h"
+#include "X86.h"
 #include "X86CallingConv.h"
 #include "X86FrameLowering.h"
 #include "X86InstrBuilder.h"
@@ -25795,6 +25796,16 @@ bool X86TargetLowering::areJTsAllowed(const Function *Fn) const {
   return TargetLowering::areJTsAllowed(Fn);
 }
 
+unsigned X86TargetLowering::getSwitchBranchCost(const SwitchInst *SI) const {
+  if (!isBranchConverted(*SI))
+    return 1;
+
+  // A converted compare and branch executes the compare, the conversion site
+  // and, on the path not taken, a skip lane hop, where the heuristics assume
+  // two instructions. A converted jump table costs a single such site.
+  return (1 + BranchConversionSiteInstrs + BranchConversionHopInstrs) / 2;
+}
+
 //===----------------------------------------------------------------------===//
 //                           X86 Scheduler Hooks
 //===----------------------------------------------------------------------===//
@@ -985,6 +985,10 @@ namespace llvm {
     /// Returns true if lowering to a jump table is allowed.
     bool areJTsAllowed(const Function *Fn) const override;
 
+    /// Returns the cost of the conditional branches of a switch, which is
+    /// higher in functions converted by X86BranchConversion.
+    unsigned getSwitchBranchCost(const SwitchInst *SI) const override;
+
     /// If true, then instruction selection should
     /// seek to shrink the FP constant of the specified type to a smaller type
     /// in order to save space and / or reduce runtime.
@@ -83,6 +83,9 @@ CondCode getCondFromCMovOpc(unsigned Opc);
 // Turn Conditional Branch opcode into condition code.
 CondCode getCondFromBranchOpc(unsigned BrOpc);
 
+// Turn SETcc opcode into condition code.
+CondCode getCondFromSETOpc(unsigned Opc);
+
 /// GetOppositeBranchCondition - Return the inverse of the specified cond,
 /// e.g. turning COND_E to COND_NE.
 CondCode GetOppositeBranchCondition(CondCode CC);
@@ -363,6 +366,7 @@ public:
                         MachineBasicBlock *FBB, ArrayRef<MachineOperand> Cond,
                         const DebugLoc &DL,
                         int *BytesAdded = nullptr) const override;
+  unsigned getExtraBranchCost(const MachineBasicBlock &MBB) const override;
   bool canInsertSelect(const MachineBasicBlock &, ArrayRef<MachineOperand> Cond,
                        unsigned, unsigned, int &, int &, int &) const override;
   void insertSelect(MachineBasicBlock &MBB, MachineBasicBlock::iterator MI,
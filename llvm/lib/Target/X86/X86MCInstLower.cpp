@@ -2029,4 +2029,8 @@ void X86AsmPrinter::EmitInstruction(const MachineInstr *MI) {
   }
 
   EmitAndCountInstruction(TmpInst);
+
+  // Trampoline fixups patch the displacement that ends the instruction
+  if (MCSymbol *End = TrampolineFixupEnds.lookup(MI))
+    OutStreamer->EmitLabel(End);
 }
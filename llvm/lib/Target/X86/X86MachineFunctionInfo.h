@@ -14,6 +14,7 @@
 #ifndef LLVM_LIB_TARGET_X86_X86MACHINEFUNCTIONINFO_H
 #define LLVM_LIB_TARGET_X86_X86MACHINEFUNCTIONINFO_H
 
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/CodeGen/CallingConvLower.h"
 #include "llvm/CodeGen/MachineFunction.h"
 #include "llvm/CodeGen/MachineValueType.h"
@@ -101,6 +102,24 @@ class X86MachineFunctionInfo : public MachineFunctionInfo {
   /// True if this function has WIN_ALLOCA instructions.
   bool HasWinAlloca = false;
 
+  /// The range of trampoline blocks added by branch conversion that is
+  /// emitted into TrampolineSection instead of the function's own section.
+  const MachineBasicBlock *FirstTrampoline = nullptr;
+  const MachineBasicBlock *LastTrampoline = nullptr;
+  std::string TrampolineSection;
+  unsigned TrampolineAlignment = 1;
+  /// Set when the trampoline region is described in the trampoline table.
+  bool TrampolineTable = false;
+  /// Trampoline blocks that get a local symbol of their own.
+  SmallPtrSet<const MachineBasicBlock *, 16> SymbolizedTrampolines;
+
+  /// Set when branch conversion ran before block placement, along with the
+  /// number of fake block jumps it created and of conditional branches it
+  /// kept, so the result can be checked once the layout is final.
+  bool BranchConversionPreLayout = false;
+  unsigned NumBranchConversionSites = 0;
+  unsigned NumBranchConversionKeptBranches = 0;
+
 private:
   /// ForwardedMustTailRegParms - A list of virtual and physical registers
   /// that must be forwarded to every musttail call.
@@ -178,6 +197,40 @@ public:
 
   bool hasWinAlloca() const { return HasWinAlloca; }
   void setHasWinAlloca(bool v) { HasWinAlloca = v; }
+
+  const MachineBasicBlock *getFirstTrampoline() const { return FirstTrampoline; }
+  const MachineBasicBlock *getLastTrampoline() const { return LastTrampoline; }
+  StringRef getTrampolineSection() const { return TrampolineSection; }
+  unsigned getTrampolineAlignment() const { return TrampolineAlignment; }
+  void setTrampolineSection(const MachineBasicBlock *First,
+                            const MachineBasicBlock *Last, StringRef Name,
+                            unsigned Align) {
+    FirstTrampoline = First;
+    LastTrampoline = Last;
+    TrampolineSection = Name;
+    TrampolineAlignment = Align;
+  }
+  bool hasTrampolineTable() const { return TrampolineTable; }
+  void setTrampolineTable() { TrampolineTable = true; }
+  bool hasTrampolineSymbol(const MachineBasicBlock *MBB) const {
+    return SymbolizedTrampolines.count(MBB);
+  }
+  void addTrampolineSymbol(const MachineBasicBlock *MBB) {
+    SymbolizedTrampolines.insert(MBB);
+  }
+
+  bool isBranchConversionPreLayout() const { return BranchConversionPreLayout; }
+  unsigned getNumBranchConversionSites() const {
+    return NumBranchConversionSites;
+  }
+  unsigned getNumBranchConversionKeptBranches() const {
+    return NumBranchConversionKeptBranches;
+  }
+  void setBranchConversionPreLayout(unsigned Sites, unsigned KeptBranches) {
+    BranchConversionPreLayout = true;
+    NumBranchConversionSites = Sites;
+    NumBranchConversionKeptBranches = KeptBranches;
+  }
 };
 
 } // End llvm namespace
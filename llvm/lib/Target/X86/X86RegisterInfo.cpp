@@ -42,6 +42,11 @@ static cl::opt<bool>
 EnableBasePointer("x86-use-base-pointer", cl::Hidden, cl::init(true),
           cl::desc("Enable use of a base pointer for complex stack frames"));
 
+cl::opt<bool>
+BranchConversionReserveRegs("x86-bc-reserve-regs", cl::Hidden, cl::init(false),
+          cl::desc("Reserve R10 and R11 for branch conversion instead of "
+                   "selecting free scratch registers from liveness"));
+
 X86RegisterInfo::X86RegisterInfo(const Triple &TT)
     : X86GenRegisterInfo((TT.isArch64Bit() ? X86::RIP : X86::EIP),
                          X86_MC::getDwarfRegFlavour(TT, false),
@@ -573,15 +578,15 @@ BitVector X86RegisterInfo::getReservedRegs(const MachineFunction &MF) const {
   assert(checkAllSuperRegsMarked(Reserved,
                                  {X86::SIL, X86::DIL, X86::BPL, X86::SPL}));
 
-  // Reserve BranchConversion registers
-  Reserved.set(X86::R13);
-  Reserved.set(X86::R13D);
-  Reserved.set(X86::R13W);
-  Reserved.set(X86::R13B);
-  Reserved.set(X86::R14);
-  Reserved.set(X86::R14D);
-  Reserved.set(X86::R14W);
-  Reserved.set(X86::R14B);
+  // Branch conversion normally picks free scratch registers per block, only
+  // reserve fixed ones if asked to. Both are caller-saved, so clobbering them
+  // outside of any live range is always ABI-safe.
+  if (BranchConversionReserveRegs && Is64Bit) {
+    for (unsigned Reg : {X86::R10, X86::R11})
+      for (MCSubRegIterator I(Reg, this, /*IncludeSelf=*/true); I.isValid(); ++I)
+        Reserved.set(*I);
+  }
+
   return Reserved;
 }
 
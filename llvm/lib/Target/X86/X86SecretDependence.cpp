@@ -0,0 +1,504 @@
+//===-X86SecretDependence.cpp-Find branches that depend on secret values---===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// Copyright: Secure Systems Group, Aalto University https://ssg.aalto.fi/
+//===----------------------------------------------------------------------===//
+//
+// This pass marks the terminators whose control flow depends on annotated
+// secrets with !bcv.secret metadata. X86BranchConversion uses the marks (via
+// MachineBasicBlock::getBasicBlock) to leave all other conditional branches
+// as native Jcc when running in secret-only mode.
+//
+// Secrets are introduced by:
+//  - function parameters with the "branch-shadow-secret" attribute,
+//  - globals annotated with "branch-shadow-secret" (llvm.global.annotations),
+//  - locals annotated with "branch-shadow-secret" (llvm.var.annotation).
+//
+// Taint then flows through SSA uses, through memory (storing a tainted value
+// taints the underlying objects, loading from a tainted object gives a tainted
+// value), across calls, and through control dependence: every block between a
+// secret branch and its immediate post-dominator is marked as well, since
+// merely executing a branch there reveals the direction of the secret one.
+//
+// Memory is tracked per alloca or global whose address never escapes, i.e.,
+// is only used to access it. All other memory, escaped objects as well as
+// whatever pointers from arguments, loads or calls point to, may alias each
+// other and is tracked as a single object.
+//
+//===----------------------------------------------------------------------===//
+
+#include "X86.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/Debug.h"
+#include <map>
+#include <memory>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "x86-secret-dependence"
+
+namespace {
+
+static constexpr const char *secretAnnotation = "branch-shadow-secret";
+
+class X86SecretDependence : public ModulePass {
+public:
+  static char ID;
+
+  X86SecretDependence() : ModulePass(ID) {}
+
+  StringRef getPassName() const override { return "X86 Secret Dependence Analysis"; }
+
+  bool runOnModule(Module &M) override;
+
+private:
+  void collectSources(Module &M);
+
+  bool propagate(Function &F);
+
+  bool propagateCall(ImmutableCallSite CS, bool inSecretBlock);
+
+  bool markRegion(const BasicBlock *BB);
+
+  bool isTainted(const Value *V) const { return taintedValues.count(V); }
+
+  bool isTaintedObject(const Value *ptr);
+
+  bool taint(const Value *V) { return taintedValues.insert(V).second; }
+
+  bool taintObject(const Value *ptr);
+
+  bool propagateStore(const Value *ptr, const Value *val, bool inSecretBlock);
+
+  bool isLocalObject(const Value *obj);
+
+  PostDominatorTree &getPostDomTree(const Function &F);
+
+  const DataLayout *DL;
+
+  SmallPtrSet<const Value *, 32> taintedValues;
+  SmallPtrSet<const Value *, 16> taintedObjects;     // memory objects holding secret data
+  bool taintedEscapedMemory = false;                  // all memory that is not a local object, see isLocalObject
+  DenseMap<const Value *, bool> localObjects;        // cached results of isLocalObject
+  SmallPtrSet<const Constant *, 4> annotationEntries; // entries of llvm.global.annotations, which do not escape
+  SmallPtrSet<const Function *, 8> taintedReturns;   // functions returning secret-dependent values
+  SmallPtrSet<const Function *, 8> secretFunctions;  // functions executed under secret control flow
+  SmallPtrSet<const BasicBlock *, 32> secretBlocks;  // blocks whose terminators need conversion
+
+  std::map<const Function *, std::unique_ptr<PostDominatorTree>> postDomTrees;
+};
+
+} // end anonymous namespace
+
+ModulePass *llvm::createX86SecretDependencePass() {
+  return new X86SecretDependence();
+}
+
+char X86SecretDependence::ID = 0;
+
+bool X86SecretDependence::runOnModule(Module &M) {
+  DL = &M.getDataLayout();
+
+  collectSources(M);
+
+  // All sets only grow, so iterating until nothing changes terminates
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto &F : M)
+      if (!F.isDeclaration())
+        changed |= propagate(F);
+  }
+
+  auto &ctx = M.getContext();
+  auto *mark = MDNode::get(ctx, None);
+  bool modified = false;
+  for (auto &F : M) {
+    for (auto &BB : F) {
+      if (BB.getTerminator() == nullptr)
+        continue;
+      if (secretFunctions.count(&F) || secretBlocks.count(&BB)) {
+        BB.getTerminator()->setMetadata("bcv.secret", mark);
+        modified = true;
+      }
+    }
+  }
+
+  DEBUG(dbgs() << getPassName() << ": " << secretBlocks.size() << " secret blocks, "
+               << secretFunctions.size() << " secret functions\n");
+
+  taintedValues.clear();
+  taintedObjects.clear();
+  taintedEscapedMemory = false;
+  localObjects.clear();
+  annotationEntries.clear();
+  taintedReturns.clear();
+  secretFunctions.clear();
+  secretBlocks.clear();
+  postDomTrees.clear();
+
+  return modified;
+}
+
+static bool isSecretAnnotation(const Value *V) {
+  auto *GV = dyn_cast<GlobalVariable>(V->stripPointerCasts());
+  if (GV == nullptr || !GV->hasInitializer())
+    return false;
+  auto *str = dyn_cast<ConstantDataArray>(GV->getInitializer());
+  return str != nullptr && str->isCString() && str->getAsCString() == secretAnnotation;
+}
+
+/**
+ * @brief taint the annotated secret sources of the module
+ *
+ * @param M The module to inspect
+ */
+void X86SecretDependence::collectSources(Module &M) {
+  // Parameters
+  for (auto &F : M)
+    for (auto &arg : F.args())
+      if (F.getAttributes().getParamAttributes(arg.getArgNo()).hasAttribute(secretAnnotation))
+        taint(&arg);
+
+  // Globals, i.e., { i8* global, i8* annotation, i8* file, i32 line } entries of llvm.global.annotations
+  if (auto *annotations = M.getNamedGlobal("llvm.global.annotations")) {
+    if (auto *entries = dyn_cast<ConstantArray>(annotations->getOperand(0))) {
+      for (auto &op : entries->operands()) {
+        auto *entry = dyn_cast<ConstantStruct>(op);
+        if (entry != nullptr)
+          annotationEntries.insert(entry);
+        if (entry != nullptr && entry->getNumOperands() >= 2 && isSecretAnnotation(entry->getOperand(1)))
+          taintObject(entry->getOperand(0)->stripPointerCasts());
+      }
+    }
+  }
+
+  // Locals
+  for (auto &F : M)
+    for (auto &I : instructions(F))
+      if (auto *II = dyn_cast<IntrinsicInst>(&I))
+        if (II->getIntrinsicID() == Intrinsic::var_annotation && isSecretAnnotation(II->getArgOperand(1)))
+          taintObject(II->getArgOperand(0));
+}
+
+/**
+ * @brief propagate taint through a single function
+ *
+ * @param F The function to process
+ * @return true if any of the taint sets changed
+ */
+bool X86SecretDependence::propagate(Function &F) {
+  bool changed = false;
+
+  for (auto &BB : F) {
+    bool inSecretBlock = secretFunctions.count(&F) || secretBlocks.count(&BB);
+
+    for (auto &I : BB) {
+      if (isa<DbgInfoIntrinsic>(&I) ||
+          (isa<IntrinsicInst>(&I) && cast<IntrinsicInst>(&I)->getIntrinsicID() == Intrinsic::var_annotation))
+        continue;
+
+      if (auto *SI = dyn_cast<StoreInst>(&I)) {
+        changed |= propagateStore(SI->getPointerOperand(), SI->getValueOperand(), inSecretBlock);
+        continue;
+      }
+
+      if (auto *LI = dyn_cast<LoadInst>(&I)) {
+        if (isTainted(LI->getPointerOperand()) || isTaintedObject(LI->getPointerOperand()))
+          changed |= taint(LI);
+        continue;
+      }
+
+      // Atomics store like a store, and return the old memory contents like a load. The result of a
+      // cmpxchg also depends on the compared value, which the operand rule below covers.
+      if (auto *RMW = dyn_cast<AtomicRMWInst>(&I)) {
+        changed |= propagateStore(RMW->getPointerOperand(), RMW->getValOperand(), inSecretBlock);
+        if (isTaintedObject(RMW->getPointerOperand()))
+          changed |= taint(RMW);
+      } else if (auto *CX = dyn_cast<AtomicCmpXchgInst>(&I)) {
+        changed |= propagateStore(CX->getPointerOperand(), CX->getNewValOperand(), inSecretBlock);
+        // Whether the new value is stored depends on the compared value
+        if (isTainted(CX->getCompareOperand()))
+          changed |= taintObject(CX->getPointerOperand());
+        if (isTaintedObject(CX->getPointerOperand()))
+          changed |= taint(CX);
+      }
+
+      if (auto *RI = dyn_cast<ReturnInst>(&I)) {
+        if (RI->getReturnValue() != nullptr && isTainted(RI->getReturnValue()))
+          changed |= taintedReturns.insert(&F).second;
+        continue;
+      }
+
+      ImmutableCallSite CS(&I);
+      if (CS) {
+        changed |= propagateCall(CS, inSecretBlock);
+        continue;
+      }
+
+      for (auto &op : I.operands()) {
+        if (isTainted(op)) {
+          changed |= taint(&I);
+          break;
+        }
+      }
+
+      // Selects may be lowered to branches later in the backend, so their block needs marking
+      if (auto *sel = dyn_cast<SelectInst>(&I))
+        if (isTainted(sel->getCondition()))
+          changed |= secretBlocks.insert(&BB).second;
+    }
+
+    auto *term = BB.getTerminator();
+    if (term == nullptr || term->getNumSuccessors() < 2)
+      continue;
+
+    const Value *cond = nullptr;
+    if (auto *BI = dyn_cast<BranchInst>(term))
+      cond = BI->getCondition();
+    else if (auto *SI = dyn_cast<SwitchInst>(term))
+      cond = SI->getCondition();
+    else if (auto *IBI = dyn_cast<IndirectBrInst>(term))
+      cond = IBI->getAddress();
+
+    if (inSecretBlock || (cond != nullptr && isTainted(cond))) {
+      changed |= secretBlocks.insert(&BB).second;
+      changed |= markRegion(&BB);
+    }
+  }
+
+  return changed;
+}
+
+/**
+ * @brief propagate taint through a store of val to ptr
+ *
+ * @param ptr The address stored to
+ * @param val The stored value
+ * @param inSecretBlock Whether the store is executed under secret control flow
+ * @return true if any of the taint sets changed
+ */
+bool X86SecretDependence::propagateStore(const Value *ptr, const Value *val, bool inSecretBlock) {
+  // Stores of secrets, to secret addresses, or under secret control flow make the memory secret
+  if (inSecretBlock || isTainted(val) || isTainted(ptr))
+    return taintObject(ptr);
+  return false;
+}
+
+/**
+ * @brief check whether an object is only ever accessed through its own SSA uses
+ *
+ * This holds for allocas and globals whose address is only loaded from, stored to, compared, offset
+ * or annotated, but never stored to memory, passed to or returned from a function, or converted to
+ * an integer. No pointer of unknown origin can point into such an object, so it can be tracked on
+ * its own. Uses outside the module are not considered, as the analysis only covers this module.
+ *
+ * @param obj The underlying object of a pointer
+ * @return true if obj is tracked on its own, false if it belongs to the escaped memory
+ */
+bool X86SecretDependence::isLocalObject(const Value *obj) {
+  if (!isa<AllocaInst>(obj) && !isa<GlobalVariable>(obj))
+    return false;
+
+  auto cached = localObjects.find(obj);
+  if (cached != localObjects.end())
+    return cached->second;
+
+  SmallVector<const Value *, 16> worklist(1, obj);
+  SmallPtrSet<const Value *, 16> visited;
+  bool escapes = false;
+  while (!worklist.empty() && !escapes) {
+    const Value *V = worklist.pop_back_val();
+    for (const User *U : V->users()) {
+      if (isa<LoadInst>(U) || isa<ICmpInst>(U) || (isa<Constant>(U) && annotationEntries.count(cast<Constant>(U))))
+        continue;
+      if (auto *SI = dyn_cast<StoreInst>(U)) {
+        escapes |= SI->getValueOperand() == V;
+        continue;
+      }
+      if (auto *RMW = dyn_cast<AtomicRMWInst>(U)) {
+        escapes |= RMW->getValOperand() == V;
+        continue;
+      }
+      if (auto *CX = dyn_cast<AtomicCmpXchgInst>(U)) {
+        escapes |= CX->getNewValOperand() == V;
+        continue;
+      }
+      if (auto *II = dyn_cast<IntrinsicInst>(U)) {
+        Intrinsic::ID id = II->getIntrinsicID();
+        if (isa<DbgInfoIntrinsic>(II) || isa<MemIntrinsic>(II) || id == Intrinsic::var_annotation ||
+            id == Intrinsic::lifetime_start || id == Intrinsic::lifetime_end)
+          continue;
+      }
+      // Still the same object, its uses count as uses of the object
+      if (isa<GEPOperator>(U) || isa<BitCastOperator>(U) || isa<AddrSpaceCastInst>(U) || isa<PHINode>(U) ||
+          isa<SelectInst>(U)) {
+        if (visited.insert(U).second)
+          worklist.push_back(U);
+        continue;
+      }
+      escapes = true;
+      break;
+    }
+  }
+
+  localObjects[obj] = !escapes;
+  return !escapes;
+}
+
+/**
+ * @brief check whether the memory ptr may point to holds secret data
+ *
+ * @param ptr The pointer to check
+ * @return true if any object ptr may point to is tainted
+ */
+bool X86SecretDependence::isTaintedObject(const Value *ptr) {
+  SmallVector<Value *, 4> objects;
+  GetUnderlyingObjects(const_cast<Value *>(ptr), objects, *DL);
+  for (auto *obj : objects)
+    if (isLocalObject(obj) ? taintedObjects.count(obj) : taintedEscapedMemory)
+      return true;
+  return false;
+}
+
+/**
+ * @brief taint all objects ptr may point to
+ *
+ * Phis and selects of pointers taint each of their objects. Pointers to escaped memory and pointers
+ * of unknown origin taint all escaped memory.
+ *
+ * @param ptr The pointer to taint the objects of
+ * @return true if any of the taint sets changed
+ */
+bool X86SecretDependence::taintObject(const Value *ptr) {
+  bool changed = false;
+  SmallVector<Value *, 4> objects;
+  GetUnderlyingObjects(const_cast<Value *>(ptr), objects, *DL);
+  for (auto *obj : objects) {
+    if (isLocalObject(obj)) {
+      changed |= taintedObjects.insert(obj).second;
+    } else if (!taintedEscapedMemory) {
+      taintedEscapedMemory = true;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+/**
+ * @brief propagate taint across a call site
+ *
+ * @param CS The call site
+ * @param inSecretBlock Whether the call is executed under secret control flow
+ * @return true if any of the taint sets changed
+ */
+bool X86SecretDependence::propagateCall(ImmutableCallSite CS, bool inSecretBlock) {
+  bool changed = false;
+  auto *callee = CS.getCalledFunction();
+
+  if (callee != nullptr && !callee->isDeclaration()) {
+    // Whatever the callee does depends on the secret if it only runs on one side of a secret branch
+    if (inSecretBlock)
+      changed |= secretFunctions.insert(callee).second;
+
+    for (auto &arg : callee->args()) {
+      if (arg.getArgNo() >= CS.arg_size())
+        break;
+      auto *actual = CS.getArgument(arg.getArgNo());
+
+      if (isTainted(actual))
+        changed |= taint(&arg);
+
+      // Memory passed by pointer is shared between the caller and the callee
+      if (actual->getType()->isPointerTy()) {
+        if (isTaintedObject(actual))
+          changed |= taintObject(&arg);
+        if (isTaintedObject(&arg))
+          changed |= taintObject(actual);
+      }
+    }
+
+    if (taintedReturns.count(callee))
+      changed |= taint(CS.getInstruction());
+
+    return changed;
+  }
+
+  // Unknown callee, assume the result and any memory it can reach depends on all of its inputs
+  bool anyTainted = inSecretBlock || isTainted(CS.getCalledValue());
+  for (auto &actual : CS.args())
+    anyTainted |= isTainted(actual) || (actual->getType()->isPointerTy() && isTaintedObject(actual));
+
+  if (!anyTainted)
+    return false;
+
+  changed |= taint(CS.getInstruction());
+  for (auto &actual : CS.args())
+    if (actual->getType()->isPointerTy())
+      changed |= taintObject(actual);
+
+  return changed;
+}
+
+/**
+ * @brief mark all blocks that are control dependent on the terminator of BB
+ *
+ * These are the blocks reachable from BB before reaching its immediate post-dominator. PHIs in the
+ * post-dominator merge values from both sides of the branch and are therefore tainted.
+ *
+ * @param BB The block with the secret-dependent terminator
+ * @return true if any of the taint sets changed
+ */
+bool X86SecretDependence::markRegion(const BasicBlock *BB) {
+  bool changed = false;
+  auto &PDT = getPostDomTree(*BB->getParent());
+
+  const BasicBlock *join = nullptr;
+  if (auto *node = PDT.getNode(const_cast<BasicBlock *>(BB)))
+    if (auto *idom = node->getIDom())
+      join = idom->getBlock(); // nullptr for the virtual exit node
+
+  SmallVector<const BasicBlock *, 16> worklist(succ_begin(BB), succ_end(BB));
+  SmallPtrSet<const BasicBlock *, 16> visited;
+
+  while (!worklist.empty()) {
+    auto *cur = worklist.pop_back_val();
+    if (!visited.insert(cur).second)
+      continue;
+
+    for (auto &phi : cur->phis())
+      changed |= taint(&phi);
+
+    if (cur == join)
+      continue;
+
+    changed |= secretBlocks.insert(cur).second;
+    worklist.append(succ_begin(cur), succ_end(cur));
+  }
+
+  return changed;
+}
+
+PostDominatorTree &X86SecretDependence::getPostDomTree(const Function &F) {
+  auto &PDT = postDomTrees[&F];
+  if (!PDT) {
+    PDT.reset(new PostDominatorTree());
+    PDT->recalculate(const_cast<Function &>(F));
+  }
+  return *PDT;
+}
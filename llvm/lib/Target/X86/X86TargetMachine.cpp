@@ -54,9 +54,36 @@ static cl::opt<bool> EnableMachineCombinerPass("x86-machine-combiner",
                                cl::desc("Enable the machine combiner pass"),
                                cl::init(true), cl::Hidden);
 
-static cl::opt<bool> EnableBranchConversion("x86-branch-conversion",
-                                            cl::desc("Enable the X86 branch-to-cmov conversion."),
-                                            cl::init(false), cl::Hidden);
+cl::opt<bool> EnableBranchConversion("x86-branch-conversion",
+                                     cl::desc("Enable the X86 branch-to-cmov conversion for "
+                                              "all functions not marked no-branch-shadow-protect."),
+                                     cl::init(false), cl::Hidden);
+
+cl::opt<bool> BranchConversionSecretOnly("x86-bc-secret-only",
+                                         cl::desc("Only convert branches that depend on annotated secrets."),
+                                         cl::init(false), cl::Hidden);
+
+static cl::opt<bool> BranchConversionPreLayout("x86-bc-pre-layout",
+                                               cl::desc("Convert branches before block placement, so the "
+                                                        "trampolines are laid out with the rest of the code."),
+                                               cl::init(false), cl::Hidden);
+
+static cl::opt<BranchConversionDispatch> BranchConversionMultiversion(
+    "x86-bc-multiversion",
+    cl::desc("Give converted functions a native clone and choose between the two at each call site."),
+    cl::init(BranchConversionDispatch::None),
+    cl::values(clEnumValN(BranchConversionDispatch::None, "none", "Do not clone functions"),
+               clEnumValN(BranchConversionDispatch::Flag, "flag",
+                          "Call the native clone while the __bcv_protect global is zero"),
+               clEnumValN(BranchConversionDispatch::Context, "context",
+                          "Call native clones from functions that are not converted")),
+    cl::Hidden);
+
+cl::opt<bool> BranchConversionWholeProgramLayout(
+    "x86-bc-whole-program-layout",
+    cl::desc("Order converted functions by call graph and profile, and emit all their trampolines "
+             "into one section (meant for the LTO and ThinLTO backends)."),
+    cl::init(false), cl::Hidden);
 
 namespace llvm {
 
@@ -302,7 +329,11 @@ namespace {
 class X86PassConfig : public TargetPassConfig {
 public:
   X86PassConfig(X86TargetMachine &TM, PassManagerBase &PM)
-    : TargetPassConfig(TM, PM) {}
+    : TargetPassConfig(TM, PM) {
+    // Tail merging could fold the fake blocks of different branch sites
+    if (BranchConversionPreLayout)
+      setEnableTailMerge(false);
+  }
 
   X86TargetMachine &getX86TargetMachine() const {
     return getTM<X86TargetMachine>();
@@ -353,6 +384,11 @@ TargetPassConfig *X86TargetMachine::createPassConfig(PassManagerBase &PM) {
 void X86PassConfig::addIRPasses() {
   addPass(createAtomicExpandPass());
 
+  if (BranchConversionMultiversion != BranchConversionDispatch::None)
+    addPass(createX86BranchConversionMultiversionPass(BranchConversionMultiversion));
+  if (BranchConversionWholeProgramLayout)
+    addPass(createX86BranchConversionLayoutPass());
+
   TargetPassConfig::addIRPasses();
 
   if (TM->getOptLevel() != CodeGenOpt::None)
@@ -410,6 +446,10 @@ bool X86PassConfig::addPreISel() {
   const Triple &TT = TM->getTargetTriple();
   if (TT.isOSWindows() && TT.getArch() == Triple::x86)
     addPass(createX86WinEHStatePass());
+
+  // Runs as late as possible so that the marks also cover branches introduced by CodeGenPrepare
+  if (BranchConversionSecretOnly)
+    addPass(createX86SecretDependencePass());
   return true;
 }
 
@@ -432,7 +472,12 @@ void X86PassConfig::addPostRegAlloc() {
   addPass(createX86FloatingPointStackifierPass());
 }
 
-void X86PassConfig::addPreSched2() { addPass(createX86ExpandPseudoPass()); }
+void X86PassConfig::addPreSched2() {
+  addPass(createX86ExpandPseudoPass());
+
+  if (BranchConversionPreLayout)
+    addPass(createX86BranchConversionPass(EnableBranchConversion, BranchConversionSecretOnly, true));
+}
 
 void X86PassConfig::addPreEmitPass() {
   if (getOptLevel() != CodeGenOpt::None)
@@ -452,6 +497,10 @@ void X86PassConfig::addPreEmitPass() {
 void X86PassConfig::addPreEmitPass2() {
   addPass(createX86RetpolineThunksPass());
 
-  if (EnableBranchConversion)
-      addPass(createX86BranchConversionPass());
+  // Always added so that individual functions can opt in through their attributes. When converting
+  // before block placement, only check that the layout kept the branch sites intact.
+  if (BranchConversionPreLayout)
+    addPass(createX86BranchConversionVerifierPass());
+  else
+    addPass(createX86BranchConversionPass(EnableBranchConversion, BranchConversionSecretOnly, false));
 }
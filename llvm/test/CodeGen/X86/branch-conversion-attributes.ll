@@ -0,0 +1,61 @@
+; RUN: llc -mtriple=x86_64-pc-linux < %s | FileCheck %s --check-prefixes=CHECK,OFF
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion < %s | FileCheck %s --check-prefixes=CHECK,ON
+; RUN: sed -e 's/i32 0}/i32 1}/' %s | llc -mtriple=x86_64-pc-linux | FileCheck %s --check-prefixes=CHECK,ON
+
+;; Functions marked "branch-shadow-protect" are always converted and functions
+;; marked "no-branch-shadow-protect" never are. Unmarked functions follow the
+;; module-wide default, which is set by -x86-branch-conversion or by the
+;; "branch-shadow-protect" module flag.
+
+; CHECK-LABEL: protected:
+; CHECK:       jmpq *%r{{[a-z0-9]+}}
+; CHECK-NOT:   jne
+; CHECK:       retq
+define i32 @protected(i32 %x) #0 {
+entry:
+  %c = icmp eq i32 %x, 0
+  br i1 %c, label %zero, label %nonzero
+
+zero:
+  ret i32 1
+
+nonzero:
+  ret i32 2
+}
+
+; CHECK-LABEL: unprotected:
+; CHECK-NOT:   jmpq *%r{{[a-z0-9]+}}
+; CHECK:       retq
+define i32 @unprotected(i32 %x) #1 {
+entry:
+  %c = icmp eq i32 %x, 0
+  br i1 %c, label %zero, label %nonzero
+
+zero:
+  ret i32 1
+
+nonzero:
+  ret i32 2
+}
+
+; CHECK-LABEL: unmarked:
+; OFF-NOT:     jmpq *%r{{[a-z0-9]+}}
+; ON:          jmpq *%r{{[a-z0-9]+}}
+; CHECK:       retq
+define i32 @unmarked(i32 %x) {
+entry:
+  %c = icmp eq i32 %x, 0
+  br i1 %c, label %zero, label %nonzero
+
+zero:
+  ret i32 1
+
+nonzero:
+  ret i32 2
+}
+
+attributes #0 = { "branch-shadow-protect" }
+attributes #1 = { "no-branch-shadow-protect" }
+
+!llvm.module.flags = !{!0}
+!0 = !{i32 1, !"branch-shadow-protect", i32 0}
@@ -0,0 +1,93 @@
+; RUN: llc -mtriple=x86_64-pc-linux -mcpu=skylake < %s | FileCheck %s --check-prefix=NATIVE
+; RUN: llc -mtriple=x86_64-pc-linux -mcpu=skylake -x86-branch-conversion < %s | FileCheck %s --check-prefix=BC
+; RUN: llc -mtriple=x86_64-pc-linux -mcpu=skylake -x86-branch-conversion -x86-bc-secret-only < %s | FileCheck %s --check-prefixes=NATIVE,SECRET
+
+;; Every branch of a converted function costs a trampoline pair, so the CMOV
+;; converter leaves the CMOV in the hot loop alone, and early if-conversion
+;; turns the small diamond into a CMOV. The 32-bit CMOVs are the selects, the
+;; 64-bit ones select trampoline addresses.
+
+; NATIVE-LABEL: CmovInHotPath:
+; NATIVE-NOT:   cmov
+; NATIVE:       jg
+; BC-LABEL:     CmovInHotPath:
+; BC:           cmov{{[a-z]+}}l
+
+define void @CmovInHotPath(i32 %n, i32 %a, i32 %b, i32* nocapture %c) {
+entry:
+  %cmp14 = icmp sgt i32 %n, 0
+  br i1 %cmp14, label %for.body.preheader, label %for.cond.cleanup
+
+for.body.preheader:
+  %wide.trip.count = zext i32 %n to i64
+  br label %for.body
+
+for.cond.cleanup:
+  ret void
+
+for.body:
+  %indvars.iv = phi i64 [ %indvars.iv.next, %for.body ], [ 0, %for.body.preheader ]
+  %arrayidx = getelementptr inbounds i32, i32* %c, i64 %indvars.iv
+  %0 = load i32, i32* %arrayidx, align 4
+  %add = add nsw i32 %0, 1
+  %mul = mul nsw i32 %0, %a
+  %cmp3 = icmp sgt i32 %mul, %b
+  %. = select i1 %cmp3, i32 10, i32 %add
+  %mul7 = mul nsw i32 %., %add
+  store i32 %mul7, i32* %arrayidx, align 4
+  %indvars.iv.next = add nuw nsw i64 %indvars.iv, 1
+  %exitcond = icmp eq i64 %indvars.iv.next, %wide.trip.count
+  br i1 %exitcond, label %for.cond.cleanup, label %for.body
+}
+
+; NATIVE-LABEL: diamond:
+; NATIVE-NOT:   cmov
+; NATIVE:       j{{g|le}}
+; NATIVE:       retq
+; BC-LABEL:     diamond:
+; BC:           cmov{{[a-z]+}}l
+; BC:           retq
+
+define i32 @diamond(i32 %a, i32 %b, i32 %c) {
+entry:
+  %cmp = icmp sgt i32 %a, 0
+  br i1 %cmp, label %then, label %else
+
+then:
+  %x = xor i32 %b, %c
+  br label %join
+
+else:
+  %y = add i32 %b, 5
+  br label %join
+
+join:
+  %r = phi i32 [ %x, %then ], [ %y, %else ]
+  ret i32 %r
+}
+
+;; With -x86-bc-secret-only, only the branches marked by the secret dependence
+;; analysis are converted. The functions above keep their native heuristics,
+;; while the diamond on a secret still becomes a CMOV.
+
+; SECRET-LABEL: secret_diamond:
+; SECRET:       cmov{{[a-z]+}}l
+; SECRET:       retq
+
+define i32 @secret_diamond(i32 "branch-shadow-secret" %a, i32 %b, i32 %c) {
+entry:
+  %cmp = icmp sgt i32 %a, 0
+  br i1 %cmp, label %then, label %else
+
+then:
+  %x = xor i32 %b, %c
+  br label %join
+
+else:
+  %y = add i32 %b, 5
+  br label %join
+
+join:
+  %r = phi i32 [ %x, %then ], [ %y, %else ]
+  ret i32 %r
+}
@@ -0,0 +1,43 @@
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion < %s | FileCheck %s --check-prefix=CMOV
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion -x86-bc-cond-lowering=setcc < %s | FileCheck %s --check-prefix=SETCC
+; RUN: llc -mtriple=x86_64-pc-linux -mcpu=skylake -x86-branch-conversion -x86-bc-cond-lowering=auto < %s | FileCheck %s --check-prefix=CMOV
+
+;; By default the conditional branch loads both trampoline addresses and
+;; selects one with CMOV. The SETcc lowering aligns the two trampolines to 8
+;; bytes, so the taken one sits 8 bytes behind the fallthrough one and the
+;; SETcc result becomes the scaled index of a single LEA. On Skylake CMOV is a
+;; single micro-op, so the cost model keeps it.
+
+; CMOV-LABEL:  diamond:
+; CMOV-NOT:    set{{n?}}e
+; CMOV:        cmov{{n?}}eq
+; CMOV:        retq
+
+; SETCC-LABEL: diamond:
+; SETCC:       .p2align 3
+; SETCC:       .p2align 3
+; SETCC:       set{{n?}}e %[[IDX8:[a-z0-9]+]]
+; SETCC-NEXT:  movzbl %[[IDX8]], %{{[a-z0-9]+}}
+; SETCC-NEXT:  leaq .LBB0_{{[0-9]+}}(%rip), %[[TARGET:[a-z0-9]+]]
+; SETCC-NEXT:  leaq (%[[TARGET]],%{{[a-z0-9]+}},8), %[[TARGET]]
+; SETCC-NOT:   cmov
+; SETCC:       jmpq *%[[TARGET]]
+; SETCC:       retq
+
+define i32 @diamond(i32 %a, i32* %p) {
+entry:
+  %c = icmp eq i32 %a, 0
+  br i1 %c, label %then, label %else
+
+then:
+  store volatile i32 1, i32* %p
+  br label %join
+
+else:
+  store volatile i32 2, i32* %p
+  br label %join
+
+join:
+  %r = load volatile i32, i32* %p
+  ret i32 %r
+}
@@ -0,0 +1,69 @@
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion < %s | FileCheck %s
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion -x86-bc-trampoline-section=.text.bcv_tramp -x86-bc-trampoline-symbols < %s | FileCheck %s --check-prefix=SYMS
+
+;; Everything inserted for a branch carries its location, so the trampolines
+;; are attributed to the source branch they stand for. The prologue still ends
+;; in the entry block, not in the trampolines laid out in front of it.
+
+; CHECK-LABEL:  cond:
+; CHECK:        jmp .LBB0_0
+; CHECK-NOT:    prologue_end
+; CHECK:        .loc 1 3 7
+; CHECK-NEXT:   jmp [[THEN:.LBB0_[0-9]+]]
+; CHECK:        .LBB0_0: # %entry
+; CHECK:        .loc 1 3 9 prologue_end
+; CHECK-NEXT:   testl %edi, %edi
+; CHECK-NEXT:   .loc 1 3 7
+; CHECK-NEXT:   leaq
+; CHECK-NEXT:   leaq
+; CHECK-NEXT:   cmoveq
+; CHECK-NOT:    .loc
+; CHECK:        jmpq *%r11
+; CHECK:        [[THEN]]: # %then
+
+;; With -x86-bc-trampoline-symbols, every trampoline block gets a local,
+;; sized function symbol, even in the trampoline section.
+
+; SYMS-LABEL:   cond:
+; SYMS:         .section .text.bcv_tramp,"ax",@progbits
+; SYMS:         .LBB0_[[N:[0-9]+]]:
+; SYMS-NEXT:    .type cond.bcv.tramp.[[N]],@function
+; SYMS-NEXT:    cond.bcv.tramp.[[N]]:
+; SYMS-NEXT:    .loc 1 3 7
+; SYMS-NEXT:    jmp
+; SYMS-NEXT:    [[END:.Ltmp[0-9]+]]:
+; SYMS-NEXT:    .size cond.bcv.tramp.[[N]], [[END]]-cond.bcv.tramp.[[N]]
+; SYMS-NOT:     .globl cond.bcv.tramp
+; SYMS:         .text
+
+declare void @foo()
+
+define void @cond(i32 %a) !dbg !6 {
+entry:
+  %c = icmp eq i32 %a, 0, !dbg !9
+  br i1 %c, label %then, label %exit, !dbg !10
+
+then:
+  call void @foo(), !dbg !11
+  br label %exit, !dbg !12
+
+exit:
+  ret void, !dbg !13
+}
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "clang", isOptimized: true, runtimeVersion: 0, emissionKind: FullDebug, enums: !2)
+!1 = !DIFile(filename: "cond.c", directory: "/tmp")
+!2 = !{}
+!3 = !{i32 2, !"Dwarf Version", i32 4}
+!4 = !{i32 2, !"Debug Info Version", i32 3}
+!6 = distinct !DISubprogram(name: "cond", scope: !1, file: !1, line: 2, type: !7, isLocal: false, isDefinition: true, scopeLine: 2, isOptimized: true, unit: !0, variables: !2)
+!7 = !DISubroutineType(types: !8)
+!8 = !{null}
+!9 = !DILocation(line: 3, column: 9, scope: !6)
+!10 = !DILocation(line: 3, column: 7, scope: !6)
+!11 = !DILocation(line: 4, column: 5, scope: !6)
+!12 = !DILocation(line: 4, column: 11, scope: !6)
+!13 = !DILocation(line: 5, column: 1, scope: !6)
@@ -0,0 +1,58 @@
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion < %s | FileCheck %s --check-prefix=BLOCK
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion -x86-bc-dispatch-region=2 < %s | FileCheck %s --check-prefix=REGION
+
+;; By default the fake block of every converted block ends in its own
+;; indirect jump. With dispatch regions of two blocks, the fake block of the
+;; first block of each region falls through into the shared indirect jump and
+;; the fake block of the second one jumps to it.
+
+; BLOCK-LABEL:  f:
+; BLOCK:        # %entry
+; BLOCK:        jmpq *%r11
+; BLOCK:        # %x
+; BLOCK:        jmpq *%r11
+; BLOCK:        # %big
+; BLOCK:        jmpq *%r11
+; BLOCK:        # %t1
+; BLOCK:        jmpq *%r11
+; BLOCK:        # %t2
+
+; REGION-LABEL: f:
+; REGION:       # %entry
+; REGION:       cmov
+; REGION-NEXT:  # %bb.
+; REGION-NEXT:  [[D1:.LBB0_[0-9]+]]:
+; REGION-NEXT:  jmpq *%r11
+; REGION:       # %x
+; REGION-NOT:   jmpq
+; REGION:       jmp [[D1]]
+; REGION:       # %big
+; REGION:       leaq
+; REGION-NEXT:  .LBB0_{{[0-9]+}}:
+; REGION-NEXT:  [[D2:.LBB0_[0-9]+]]:
+; REGION-NEXT:  jmpq *%r11
+; REGION:       # %t1
+; REGION-NOT:   jmpq
+; REGION:       jmp [[D2]]
+; REGION:       # %t2
+
+define void @f(i32 %a, i32 %b, i32* %p) {
+entry:
+  %c1 = icmp eq i32 %a, 0
+  br i1 %c1, label %x, label %t1, !prof !0
+x:
+  %c2 = icmp eq i32 %b, 0
+  br i1 %c2, label %big, label %t2, !prof !0
+big:
+  store volatile i32 1, i32* %p
+  store volatile i32 2, i32* %p
+  store volatile i32 3, i32* %p
+  store volatile i32 4, i32* %p
+  br label %t1
+t1:
+  store volatile i32 5, i32* %p
+  br label %t2
+t2:
+  ret void
+}
+!0 = !{!"branch_weights", i32 1000, i32 1}
@@ -0,0 +1,80 @@
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion < %s | FileCheck %s --check-prefix=CHAIN
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion -x86-bc-fuse-chains < %s | FileCheck %s --check-prefix=FUSE
+
+;; a && b && c branches to %else from three blocks. Converted one by one,
+;; each test gets its own CMOV, fake block and trampolines. Fused, the three
+;; conditions are ORed together and a single converted branch remains.
+
+; CHAIN-LABEL: and3:
+; CHAIN:       cmov
+; CHAIN:       cmov
+; CHAIN:       cmov
+; CHAIN:       retq
+
+; FUSE-LABEL:  and3:
+; FUSE:        set{{g|le}} %[[ACC:[a-z0-9]+]]
+; FUSE:        set{{g|le}} %[[COND:[a-z0-9]+]]
+; FUSE-NEXT:   orb %[[COND]], %[[ACC]]
+; FUSE:        set{{g|le}} %[[COND]]
+; FUSE-NEXT:   orb %[[COND]], %[[ACC]]
+; FUSE-NEXT:   leaq
+; FUSE-NEXT:   leaq
+; FUSE-NEXT:   cmovneq
+; FUSE-NOT:    cmov
+; FUSE:        retq
+
+define i32 @and3(i32 %a, i32 %b, i32 %c, i32* %p) {
+entry:
+  %c1 = icmp sgt i32 %a, 0
+  br i1 %c1, label %l2, label %else
+
+l2:
+  %c2 = icmp sgt i32 %b, 0
+  br i1 %c2, label %l3, label %else
+
+l3:
+  %c3 = icmp sgt i32 %c, 0
+  br i1 %c3, label %then, label %else
+
+then:
+  store volatile i32 1, i32* %p
+  br label %join
+
+else:
+  store volatile i32 2, i32* %p
+  br label %join
+
+join:
+  %r = load volatile i32, i32* %p
+  ret i32 %r
+}
+
+;; The second test loads through %q, which the first test guards, so it must
+;; not run unconditionally.
+
+; FUSE-LABEL:  guarded_load:
+; FUSE-NOT:    orb
+; FUSE:        retq
+
+define i32 @guarded_load(i32* %q, i32* %p) {
+entry:
+  %nonnull = icmp ne i32* %q, null
+  br i1 %nonnull, label %load, label %else
+
+load:
+  %v = load i32, i32* %q
+  %pos = icmp sgt i32 %v, 0
+  br i1 %pos, label %then, label %else
+
+then:
+  store volatile i32 1, i32* %p
+  br label %join
+
+else:
+  store volatile i32 2, i32* %p
+  br label %join
+
+join:
+  %r = load volatile i32, i32* %p
+  ret i32 %r
+}
@@ -0,0 +1,54 @@
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion < %s | FileCheck %s
+; RUN: llc -mtriple=x86_64-pc-linux -relocation-model=pic -x86-branch-conversion < %s | FileCheck %s --check-prefix=PIC
+
+;; Switches lowered to jump tables stay jump tables. The dispatch loads the
+;; table entry into a scratch register and jumps through the fake block, and
+;; every table entry points to a trampoline block that jumps on to the real
+;; case block.
+
+; CHECK-LABEL: jt:
+; CHECK-NOT:   jmpq *.LJTI0_0
+; CHECK:       movq .LJTI0_0(,%{{[a-z0-9]+}},8), [[REG:%r[a-z0-9]+]]
+; CHECK-NEXT:  {{\.LBB0_[0-9]+:|# %bb\.}}
+; CHECK-NEXT:  jmpq *[[REG]]
+; CHECK-LABEL: .LJTI0_0:
+; CHECK-NEXT:  .quad .LBB0_[[T0:[0-9]+]]
+
+; PIC-LABEL:   jt:
+; PIC:         movq %{{[a-z0-9]+}}, [[PICREG:%r[a-z0-9]+]]
+; PIC-NEXT:    {{\.LBB0_[0-9]+:|# %bb\.}}
+; PIC-NEXT:    jmpq *[[PICREG]]
+
+declare void @a()
+declare void @b()
+declare void @c()
+declare void @d()
+
+define void @jt(i32 %x) {
+entry:
+  switch i32 %x, label %exit [
+    i32 0, label %case0
+    i32 1, label %case1
+    i32 2, label %case2
+    i32 3, label %case3
+  ]
+
+case0:
+  call void @a()
+  br label %exit
+
+case1:
+  call void @b()
+  br label %exit
+
+case2:
+  call void @c()
+  br label %exit
+
+case3:
+  call void @d()
+  br label %exit
+
+exit:
+  ret void
+}
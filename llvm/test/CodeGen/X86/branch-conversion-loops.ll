@@ -0,0 +1,57 @@
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion < %s | FileCheck %s --check-prefix=REGION
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion -x86-bc-local-loop-trampolines < %s | FileCheck %s --check-prefix=LOCAL
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion -x86-bc-local-loop-trampolines -x86-bc-dispatch-region=1 < %s | FileCheck %s --check-prefix=DISPATCH
+
+;; By default the back-edge of the loop goes through a trampoline in the
+;; region in front of the function. With local loop trampolines, both
+;; trampolines of the latch are placed right after its fake block, so either
+;; direction takes a single hop next to the loop. The fake block of the latch
+;; falls through into a new dispatcher, so with dispatch regions the
+;; trampolines follow the dispatcher instead.
+
+; REGION-LABEL: hot_loop:
+; REGION:       jmp [[HEADER:.LBB0_[0-9]+]]
+; REGION:       [[HEADER]]:
+; REGION:       cmov
+; REGION-NEXT:  # %bb.
+; REGION-NEXT:  jmpq *%r{{[a-z0-9]+}}
+; REGION-NOT:   jmp [[HEADER]]
+; REGION:       retq
+
+; LOCAL-LABEL:  hot_loop:
+; LOCAL:        [[HEADER:.LBB0_[0-9]+]]: {{.*}}# %loop
+; LOCAL-NEXT:   Loop Header
+; LOCAL:        cmov
+; LOCAL-NEXT:   # %bb.
+; LOCAL-NEXT:   jmpq *%r{{[a-z0-9]+}}
+; LOCAL-NEXT:   .LBB0_{{[0-9]+}}:
+; LOCAL-NEXT:   jmp .LBB0_{{[0-9]+}}
+; LOCAL-NEXT:   .LBB0_{{[0-9]+}}:
+; LOCAL-NEXT:   jmp [[HEADER]]
+
+; DISPATCH-LABEL: hot_loop:
+; DISPATCH:       [[HEADER:.LBB0_[0-9]+]]: {{.*}}# %loop
+; DISPATCH:       cmov
+; DISPATCH-NEXT:  # %bb.
+; DISPATCH-NEXT:  # %bb.
+; DISPATCH-NEXT:  jmpq *%r{{[a-z0-9]+}}
+; DISPATCH-NEXT:  .LBB0_{{[0-9]+}}:
+; DISPATCH-NEXT:  jmp .LBB0_{{[0-9]+}}
+; DISPATCH-NEXT:  .LBB0_{{[0-9]+}}:
+; DISPATCH-NEXT:  jmp [[HEADER]]
+
+define void @hot_loop(i32* %p, i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %inc, %loop ]
+  %gep = getelementptr inbounds i32, i32* %p, i32 %i
+  store i32 %i, i32* %gep
+  %inc = add nsw i32 %i, 1
+  %cmp = icmp slt i32 %inc, %n
+  br i1 %cmp, label %loop, label %exit
+
+exit:
+  ret void
+}
@@ -0,0 +1,76 @@
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion -x86-bc-multiversion=flag < %s | FileCheck %s --check-prefix=FLAG
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion -x86-bc-multiversion=context < %s | FileCheck %s --check-prefix=CTX
+
+;; Each converted function that is called directly gets a native clone. With
+;; flag dispatch, every call site selects the version from __bcv_protect. With
+;; context dispatch, @bulk is not converted and therefore calls the native
+;; clone of @leaf, which in turn calls the native clone of @helper, while
+;; @handler keeps calling the converted @leaf.
+
+; FLAG-LABEL:  handler:
+; FLAG:        __bcv_protect(%rip)
+; FLAG:        cmov{{n?}}eq
+; FLAG:        callq *%
+; FLAG-LABEL:  helper.bcv.native:
+; FLAG-NOT:    cmov
+; FLAG:        retq
+; FLAG-LABEL:  leaf.bcv.native:
+; FLAG:        __bcv_protect(%rip)
+; FLAG:        callq *%
+; FLAG:        retq
+; FLAG:        .weak __bcv_protect
+; FLAG:        __bcv_protect:
+; FLAG-NEXT:   .byte 1
+
+; CTX-LABEL:   handler:
+; CTX:         callq leaf{{$}}
+; CTX-LABEL:   bulk:
+; CTX:         callq leaf.bcv.native
+; CTX-LABEL:   leaf.bcv.native:
+; CTX-NOT:     cmov
+; CTX:         callq helper.bcv.native
+; CTX-LABEL:   helper.bcv.native:
+; CTX-NOT:     cmov
+; CTX:         retq
+; CTX-NOT:     __bcv_protect
+
+define void @helper(i32 %a, i32* %p) {
+entry:
+  %c = icmp sgt i32 %a, 0
+  br i1 %c, label %then, label %exit
+
+then:
+  store volatile i32 1, i32* %p
+  br label %exit
+
+exit:
+  ret void
+}
+
+define void @leaf(i32 %a, i32* %p) {
+entry:
+  call void @helper(i32 %a, i32* %p)
+  %c = icmp eq i32 %a, 7
+  br i1 %c, label %then, label %exit
+
+then:
+  store volatile i32 2, i32* %p
+  br label %exit
+
+exit:
+  ret void
+}
+
+define void @handler(i32 %a, i32* %p) {
+entry:
+  call void @leaf(i32 %a, i32* %p)
+  ret void
+}
+
+define void @bulk(i32 %a, i32* %p) #0 {
+entry:
+  call void @leaf(i32 %a, i32* %p)
+  ret void
+}
+
+attributes #0 = { "no-branch-shadow-protect" }
@@ -0,0 +1,28 @@
+; RUN: llc -mtriple=x86_64-pc-linux -mcpu=skylake -x86-branch-conversion -x86-bc-overhead-report -pass-remarks-analysis=x86-branch-conversion -o /dev/null < %s 2>&1 | FileCheck %s
+; RUN: llc -mtriple=x86_64-pc-linux -mcpu=skylake -x86-branch-conversion -x86-bc-overhead-budget=1 -o /dev/null < %s 2>&1 | FileCheck %s --check-prefix=BUDGET
+; RUN: llc -mtriple=x86_64-pc-linux -mcpu=skylake -x86-branch-conversion -x86-bc-overhead-budget=100000 -o /dev/null < %s 2>&1 | FileCheck %s --check-prefix=NOBUDGET --allow-empty
+
+;; The overhead of the conversion is estimated with the scheduling model and
+;; weighted by block frequency. Functions exceeding the budget get a warning.
+;; The conversion adds the CMOV sequence, the indirect jump and the trampoline
+;; jumps to the 18.14 cycles of the native code, 36% more.
+
+; CHECK:    remark: {{.*}}estimated cycles 18.14 -> 24.76, uops 11.52 -> 18.14, 51 bytes added
+
+; BUDGET:   branch conversion cycle overhead percentage limit of 1 exceeded (36) in cond
+; NOBUDGET-NOT: exceeded
+
+declare void @foo()
+
+define void @cond(i32 %a) {
+entry:
+  %c = icmp eq i32 %a, 0
+  br i1 %c, label %then, label %exit
+
+then:
+  call void @foo()
+  br label %exit
+
+exit:
+  ret void
+}
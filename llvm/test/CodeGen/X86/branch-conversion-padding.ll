@@ -0,0 +1,35 @@
+; RUN: llc -mtriple=x86_64-pc-linux -mcpu=skylake -x86-branch-conversion -x86-bc-dummy-instr < %s | FileCheck %s --check-prefix=COUNT
+; RUN: llc -mtriple=x86_64-pc-linux -mcpu=skylake -x86-branch-conversion -x86-bc-dummy-instr -x86-bc-dummy-padding=latency < %s | FileCheck %s --check-prefix=LATENCY
+
+;; The skip lane of the conditional branch hops over the long block. By
+;; default its trampoline gets one flag-clobbering add per instruction of the
+;; block. With the latency model it instead gets a short chain of dependent
+;; instructions on the scratch register that leave EFLAGS alone.
+
+; COUNT-LABEL:  skip:
+; COUNT:        addb $0, %r{{[a-z0-9]+}}
+; COUNT-NEXT:   addb $0, %r{{[a-z0-9]+}}
+
+; LATENCY-LABEL: skip:
+; LATENCY-NOT:   addb $0
+; LATENCY:       {{not|bswap|lea}}{{[lq]}} {{.*}}%r{{[a-z0-9]+}}
+; LATENCY:       retq
+
+define i32 @skip(i32 %a, i32* %p) {
+entry:
+  %c = icmp eq i32 %a, 0
+  br i1 %c, label %exit, label %long
+
+long:
+  %v0 = load volatile i32, i32* %p
+  %v1 = mul i32 %v0, %a
+  %v2 = mul i32 %v1, %v0
+  %v3 = mul i32 %v2, %v1
+  %v4 = sdiv i32 %v3, 7
+  store volatile i32 %v4, i32* %p
+  br label %exit
+
+exit:
+  %r = phi i32 [ 0, %entry ], [ %v4, %long ]
+  ret i32 %r
+}
@@ -0,0 +1,63 @@
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion < %s | FileCheck %s --check-prefix=POST
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion -x86-bc-pre-layout -verify-machineinstrs < %s | FileCheck %s --check-prefix=PRE
+
+;; After layout, the function starts with a jump over the trampoline region.
+;; Converting before block placement leaves the trampolines as ordinary
+;; blocks: the original entry stays in front, and block placement lays out
+;; the trampolines with the rest of the code, dropping the jumps of those it
+;; places in front of their target. Every block still leaves through the
+;; single indirect jump of its fake block.
+
+; POST-LABEL: diamond:
+; POST:       jmp .LBB0_
+; POST:       cmov
+
+; PRE-LABEL:  diamond:
+; PRE-NOT:    jmp
+; PRE:        cmov
+; PRE-NEXT:   # %bb.
+; PRE-NEXT:   jmpq *%r{{[a-z0-9]+}}
+; PRE:        retq
+
+define i32 @diamond(i32 %a, i32* %p) {
+entry:
+  %c = icmp eq i32 %a, 0
+  br i1 %c, label %then, label %else
+
+then:
+  store volatile i32 1, i32* %p
+  br label %join
+
+else:
+  store volatile i32 2, i32* %p
+  br label %join
+
+join:
+  %r = load volatile i32, i32* %p
+  ret i32 %r
+}
+
+; PRE-LABEL:  hot_loop:
+; PRE:        in Loop: Header=BB1_1
+; PRE-NEXT:   .LBB1_1: {{.*}}# %loop
+; PRE-NOT:    jmp .LBB1_
+; PRE:        cmov
+; PRE-NEXT:   # %bb.
+; PRE-NEXT:   jmpq *%r{{[a-z0-9]+}}
+; PRE:        retq
+
+define void @hot_loop(i32* %p, i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %inc, %loop ]
+  %gep = getelementptr inbounds i32, i32* %p, i32 %i
+  store i32 %i, i32* %gep
+  %inc = add nsw i32 %i, 1
+  %cmp = icmp slt i32 %inc, %n
+  br i1 %cmp, label %loop, label %exit
+
+exit:
+  ret void
+}
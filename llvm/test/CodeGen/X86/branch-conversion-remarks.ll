@@ -0,0 +1,38 @@
+; REQUIRES: asserts
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion -pass-remarks-output=%t -stats -o /dev/null < %s 2>&1 | FileCheck %s --check-prefix=STATS
+; RUN: FileCheck %s < %t
+
+;; Every converted function gets a remark with the conversion counts, and the
+;; counts add up in the statistics.
+
+; CHECK:      --- !Passed
+; CHECK-NEXT: Pass:            x86-branch-conversion
+; CHECK-NEXT: Name:            Converted
+; CHECK-NEXT: Function:        cond
+; CHECK-NEXT: Args:
+; CHECK-NEXT:   - String:          'converted '
+; CHECK-NEXT:   - CondBranches:    '1'
+; CHECK-NEXT:   - String:          ' conditional branches, '
+; CHECK-NEXT:   - Jumps:           '{{[0-9]+}}'
+; CHECK:        - Trampolines:     '{{[0-9]+}}'
+; CHECK:        - SkipHops:        '{{[0-9]+}}'
+; CHECK:        - BytesAdded:      '{{[0-9]+}}'
+
+; STATS: 1 x86-branch-conversion - Number of conditional branches converted
+; STATS: 1 x86-branch-conversion - Number of functions converted
+; STATS: x86-branch-conversion - Number of trampoline blocks created
+
+declare void @foo()
+
+define void @cond(i32 %a) {
+entry:
+  %c = icmp eq i32 %a, 0
+  br i1 %c, label %then, label %exit
+
+then:
+  call void @foo()
+  br label %exit
+
+exit:
+  ret void
+}
@@ -0,0 +1,44 @@
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion < %s | FileCheck %s
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion -x86-bc-reserve-regs < %s | FileCheck %s --check-prefix=RESERVE
+
+;; Branch conversion picks its scratch registers from the registers that are
+;; free at each converted block, so nothing is reserved for it globally. A
+;; value kept in %r11 across the branch pushes the selection to the next free
+;; registers, and callee-saved registers the prologue does not save are never
+;; touched. With -x86-bc-reserve-regs the fixed %r11/%r10 pair is used.
+
+; CHECK-LABEL:   live_r11:
+; CHECK-NOT:     pushq
+; CHECK:         testl
+; CHECK-NEXT:    leaq .LBB0_{{[0-9]+}}(%rip), [[TARGET:%r[a-z0-9]+]]
+; CHECK-NEXT:    leaq .LBB0_{{[0-9]+}}(%rip), [[TMP:%r[a-z0-9]+]]
+; CHECK-NEXT:    cmov{{[a-z]+}} [[TMP]], [[TARGET]]
+; CHECK-NEXT:    # %bb.
+; CHECK-NEXT:    jmpq *[[TARGET]]
+; CHECK-NOT:     %r11,
+; CHECK-NOT:     %r1{{[2-5]}}
+; CHECK-NOT:     %rbx
+; CHECK:         retq
+
+; RESERVE-LABEL: live_r11:
+; RESERVE:       testl
+; RESERVE-NEXT:  leaq .LBB0_{{[0-9]+}}(%rip), %r11
+; RESERVE-NEXT:  leaq .LBB0_{{[0-9]+}}(%rip), %r10
+; RESERVE-NEXT:  cmov{{[a-z]+}} %r10, %r11
+; RESERVE-NEXT:  # %bb.
+; RESERVE-NEXT:  jmpq *%r11
+
+define void @live_r11(i32 %a) {
+entry:
+  %v = call i64 asm sideeffect "", "={r11}"()
+  %c = icmp eq i32 %a, 0
+  br i1 %c, label %then, label %exit
+
+then:
+  call void asm sideeffect "", "~{memory}"()
+  br label %exit
+
+exit:
+  call void asm sideeffect "", "{r11}"(i64 %v)
+  ret void
+}
@@ -0,0 +1,180 @@
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion < %s | FileCheck %s --check-prefixes=CHECK,ALL
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion -x86-bc-secret-only < %s | FileCheck %s --check-prefixes=CHECK,SECRET
+
+;; With -x86-bc-secret-only, only conditional branches that depend on values
+;; annotated with "branch-shadow-secret" are converted. The check on %n stays a
+;; native jump, while the check on the secret %s still goes through a CMOV.
+
+; CHECK-LABEL: mixed:
+; ALL-NOT:     {{^[[:space:]]+j(n?e)[[:space:]]}}
+; SECRET:      {{^[[:space:]]+j(n?e)[[:space:]]}}
+; CHECK:       cmov{{[gl]e?}}q
+; CHECK:       jmpq *%r{{[a-z0-9]+}}
+define i32 @mixed(i32 "branch-shadow-secret" %s, i32 %n) {
+entry:
+  %c1 = icmp eq i32 %n, 0
+  br i1 %c1, label %early, label %check
+
+early:
+  ret i32 0
+
+check:
+  %c2 = icmp sgt i32 %s, 10
+  br i1 %c2, label %big, label %small
+
+big:
+  ret i32 1
+
+small:
+  ret i32 2
+}
+
+;; Taint flows through memory: the secret is stored to a local and reloaded
+;; before the comparison.
+
+; CHECK-LABEL: through_memory:
+; CHECK:       cmov{{[gl]e?}}q
+define i32 @through_memory(i32 "branch-shadow-secret" %s) {
+entry:
+  %slot = alloca i32
+  store volatile i32 %s, i32* %slot
+  %v = load volatile i32, i32* %slot
+  %c = icmp sgt i32 %v, 10
+  br i1 %c, label %big, label %small
+
+big:
+  ret i32 1
+
+small:
+  ret i32 2
+}
+
+;; Memory taint covers every object a pointer may point to. The stores below
+;; go through a phi, a select, a pointer reloaded from memory, a pointer
+;; returned by a call and atomics, and the secret is read back from %a.
+
+; SECRET-LABEL: store_through_phi:
+; SECRET:       {{^[[:space:]]+j(n?e)[[:space:]]}}
+; SECRET:       cmov{{[gl]e?}}q
+define i32 @store_through_phi(i32 "branch-shadow-secret" %s, i1 %which) {
+entry:
+  %a = alloca i32
+  %b = alloca i32
+  br i1 %which, label %left, label %right
+
+left:
+  store volatile i32 0, i32* %b
+  br label %join
+
+right:
+  store volatile i32 1, i32* %b
+  br label %join
+
+join:
+  %p = phi i32* [ %a, %left ], [ %b, %right ]
+  store volatile i32 %s, i32* %p
+  %v = load volatile i32, i32* %a
+  %c = icmp sgt i32 %v, 10
+  br i1 %c, label %big, label %small
+
+big:
+  ret i32 1
+
+small:
+  ret i32 2
+}
+
+; SECRET-LABEL: store_through_select:
+; SECRET:       cmov{{[gl]e?}}q
+define i32 @store_through_select(i32 "branch-shadow-secret" %s, i1 %which) {
+entry:
+  %a = alloca i32
+  %b = alloca i32
+  %p = select i1 %which, i32* %a, i32* %b
+  store volatile i32 %s, i32* %p
+  %v = load volatile i32, i32* %a
+  %c = icmp sgt i32 %v, 10
+  br i1 %c, label %big, label %small
+
+big:
+  ret i32 1
+
+small:
+  ret i32 2
+}
+
+; SECRET-LABEL: store_through_reloaded_pointer:
+; SECRET:       cmov{{[gl]e?}}q
+define i32 @store_through_reloaded_pointer(i32 "branch-shadow-secret" %s) {
+entry:
+  %a = alloca i32
+  %slot = alloca i32*
+  store volatile i32* %a, i32** %slot
+  %p = load volatile i32*, i32** %slot
+  store volatile i32 %s, i32* %p
+  %v = load volatile i32, i32* %a
+  %c = icmp sgt i32 %v, 10
+  br i1 %c, label %big, label %small
+
+big:
+  ret i32 1
+
+small:
+  ret i32 2
+}
+
+define internal i32* @identity(i32* %p) noinline {
+  ret i32* %p
+}
+
+; SECRET-LABEL: store_through_returned_pointer:
+; SECRET:       cmov{{[gl]e?}}q
+define i32 @store_through_returned_pointer(i32 "branch-shadow-secret" %s) {
+entry:
+  %a = alloca i32
+  %p = call i32* @identity(i32* %a)
+  store volatile i32 %s, i32* %p
+  %v = load volatile i32, i32* %a
+  %c = icmp sgt i32 %v, 10
+  br i1 %c, label %big, label %small
+
+big:
+  ret i32 1
+
+small:
+  ret i32 2
+}
+
+; SECRET-LABEL: store_through_atomicrmw:
+; SECRET:       cmov{{[gl]e?}}q
+define i32 @store_through_atomicrmw(i32 "branch-shadow-secret" %s) {
+entry:
+  %a = alloca i32
+  %old = atomicrmw xchg i32* %a, i32 %s seq_cst
+  %v = load volatile i32, i32* %a
+  %c = icmp sgt i32 %v, 10
+  br i1 %c, label %big, label %small
+
+big:
+  ret i32 1
+
+small:
+  ret i32 2
+}
+
+; SECRET-LABEL: store_through_cmpxchg:
+; SECRET:       cmov{{[gl]e?}}q
+define i32 @store_through_cmpxchg(i32 "branch-shadow-secret" %s) {
+entry:
+  %a = alloca i32
+  %pair = cmpxchg i32* %a, i32 0, i32 %s seq_cst seq_cst
+  %v = load volatile i32, i32* %a
+  %c = icmp sgt i32 %v, 10
+  br i1 %c, label %big, label %small
+
+big:
+  ret i32 1
+
+small:
+  ret i32 2
+}
@@ -0,0 +1,88 @@
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion -x86-bc-dummy-instr < %s | FileCheck %s --check-prefix=PRIVATE
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion -x86-bc-dummy-instr -x86-bc-share-padding < %s | FileCheck %s --check-prefix=SHARED
+
+;; The skip lanes heading to %t1 and %t2 both hop over %big, and each of the
+;; two hops carries its own copy of the padding for %big. With shared padding
+;; both hops load the address of their next trampoline and jump to a single
+;; padded trampoline, which continues to the fake block of %big.
+
+; PRIVATE-LABEL: f:
+; PRIVATE:       addb $0, %r11b
+; PRIVATE-NEXT:  addb $0, %r11b
+; PRIVATE-NEXT:  leaq
+; PRIVATE:       addb $0, %r11b
+; PRIVATE-NEXT:  addb $0, %r11b
+; PRIVATE-NEXT:  leaq
+
+; SHARED-LABEL:  f:
+; SHARED-NOT:    addb
+; SHARED:        addb $0, %r11b
+; SHARED-NEXT:   addb $0, %r11b
+; SHARED-NEXT:   jmp .LBB0_
+; SHARED-NOT:    addb
+; SHARED:        leaq {{.*}}%r11
+; SHARED-NEXT:   jmp [[PAD:.LBB0_[0-9]+]]
+; SHARED-NOT:    addb
+; SHARED:        leaq {{.*}}%r11
+; SHARED-NEXT:   jmp [[PAD]]
+; SHARED-NOT:    addb
+; SHARED:        retq
+
+define void @f(i32 %a, i32 %b, i32* %p) {
+entry:
+  %c1 = icmp eq i32 %a, 0
+  br i1 %c1, label %x, label %t1, !prof !0
+x:
+  %c2 = icmp eq i32 %b, 0
+  br i1 %c2, label %big, label %t2, !prof !0
+big:
+  store volatile i32 1, i32* %p
+  store volatile i32 2, i32* %p
+  store volatile i32 3, i32* %p
+  store volatile i32 4, i32* %p
+  br label %t1
+t1:
+  store volatile i32 5, i32* %p
+  br label %t2
+t2:
+  ret void
+}
+
+;; A lone hop goes through the padded trampoline as well, so every hop takes two
+;; direct jumps to the fake block with shared padding and one without.
+
+; PRIVATE-LABEL: g:
+; PRIVATE:       {{^}}[[HOP:.LBB1_[0-9]+]]:{{[[:space:]]+}}addb $0, %r11b
+; PRIVATE-NEXT:  addb $0, %r11b
+; PRIVATE-NEXT:  leaq {{.*}}%r11
+; PRIVATE-NEXT:  jmp [[FAKE:.LBB1_[0-9]+]]
+; PRIVATE:       leaq [[HOP]](%rip)
+; PRIVATE:       {{^}}[[FAKE]]:
+; PRIVATE-NEXT:  jmpq *%r11
+
+; SHARED-LABEL:  g:
+; SHARED:        {{^}}[[PAD:.LBB1_[0-9]+]]:{{[[:space:]]+}}addb $0, %r11b
+; SHARED-NEXT:   addb $0, %r11b
+; SHARED-NEXT:   jmp [[FAKE:.LBB1_[0-9]+]]
+; SHARED-NEXT:   {{^}}[[HOP:.LBB1_[0-9]+]]:
+; SHARED-NEXT:   leaq {{.*}}%r11
+; SHARED-NEXT:   jmp [[PAD]]
+; SHARED:        leaq [[HOP]](%rip)
+; SHARED:        {{^}}[[FAKE]]:
+; SHARED-NEXT:   jmpq *%r11
+
+define void @g(i32 %a, i32* %p) {
+entry:
+  %c = icmp eq i32 %a, 0
+  br i1 %c, label %big, label %t, !prof !0
+big:
+  store volatile i32 1, i32* %p
+  store volatile i32 2, i32* %p
+  store volatile i32 3, i32* %p
+  store volatile i32 4, i32* %p
+  br label %t
+t:
+  ret void
+}
+
+!0 = !{!"branch_weights", i32 1000, i32 1}
@@ -0,0 +1,39 @@
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion -filetype=obj < %s | llvm-objdump -d - | FileCheck %s --check-prefix=REL32
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion -x86-bc-short-jumps -filetype=obj < %s | llvm-objdump -d - | FileCheck %s --check-prefix=SHORT
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion -x86-bc-short-jumps -x86-bc-cond-lowering=setcc < %s | FileCheck %s --check-prefix=SETCC
+
+;; Trampoline jumps are JMP rel32 by default, so both lanes have the same size.
+;; With short jumps every target of this small function is in range of a
+;; JMP rel8. The SETcc lowering still fits the fallthrough trampoline into its
+;; 8-byte slot.
+
+; REL32-LABEL: diamond:
+; REL32-NOT:   {{:[[:space:]]+eb [0-9a-f][0-9a-f][[:space:]]+jmp}}
+; REL32:       {{:[[:space:]]+e9 [0-9a-f][0-9a-f] 00 00 00[[:space:]]+jmp}}
+
+; SHORT-LABEL: diamond:
+; SHORT-NOT:   {{:[[:space:]]+e9 [0-9a-f][0-9a-f] 00 00 00[[:space:]]+jmp}}
+; SHORT:       {{:[[:space:]]+eb [0-9a-f][0-9a-f][[:space:]]+jmp}}
+
+; SETCC-LABEL: diamond:
+; SETCC:       set{{n?}}e
+; SETCC:       leaq (%{{[a-z0-9]+}},%{{[a-z0-9]+}},8)
+; SETCC:       retq
+
+define i32 @diamond(i32 %a, i32* %p) {
+entry:
+  %c = icmp eq i32 %a, 0
+  br i1 %c, label %then, label %else
+
+then:
+  store volatile i32 1, i32* %p
+  br label %join
+
+else:
+  store volatile i32 2, i32* %p
+  br label %join
+
+join:
+  %r = load volatile i32, i32* %p
+  ret i32 %r
+}
@@ -0,0 +1,41 @@
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion < %s | FileCheck %s --check-prefix=CHAIN
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion -x86-bc-skip-lanes=collapse < %s | FileCheck %s --check-prefix=COLLAPSE
+
+;; %then contains no branch and falls through into %join. With the default
+;; chained skip lanes it still gets its own fake block, which both the taken
+;; path and the skip lane of the conditional have to hop through. With
+;; collapsed skip lanes it falls through directly and the skip lane jumps
+;; straight to %join.
+
+; CHAIN-LABEL:    skip:
+; CHAIN:          jmpq *%r{{[a-z0-9]+}}
+; CHAIN:          callq foo
+; CHAIN-NEXT:     leaq
+; CHAIN-NEXT:     .LBB0_{{[0-9]+}}:
+; CHAIN-NEXT:     jmpq *%r{{[a-z0-9]+}}
+; CHAIN:          callq bar
+
+; COLLAPSE-LABEL: skip:
+; COLLAPSE:       jmpq *%r{{[a-z0-9]+}}
+; COLLAPSE:       callq foo
+; COLLAPSE-NOT:   jmpq *%r{{[a-z0-9]+}}
+; COLLAPSE:       callq bar
+; COLLAPSE-NOT:   jmpq *%r{{[a-z0-9]+}}
+; COLLAPSE:       retq
+
+declare void @foo()
+declare void @bar()
+
+define void @skip(i32 %x) {
+entry:
+  %c = icmp eq i32 %x, 0
+  br i1 %c, label %then, label %join
+
+then:
+  call void @foo()
+  br label %join
+
+join:
+  call void @bar()
+  ret void
+}
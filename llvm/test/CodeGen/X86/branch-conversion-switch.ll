@@ -0,0 +1,71 @@
+; RUN: llc -mtriple=x86_64-pc-linux < %s | FileCheck %s --check-prefix=NATIVE
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion < %s | FileCheck %s --check-prefix=BC
+
+;; Branch conversion turns every compare of a switch into a trampoline pair,
+;; while a jump table becomes a single converted indirect jump and a bit test
+;; cluster needs one branch per destination. Switches of converted functions
+;; therefore use sparser jump tables and smaller bit test clusters.
+
+; NATIVE-LABEL: sparse:
+; NATIVE-NOT:   .LJTI0_0
+; NATIVE:       retq
+; BC-LABEL:     sparse:
+; BC:           .LJTI0_0
+
+define void @sparse(i32 %x, i32* %p) {
+entry:
+  switch i32 %x, label %exit [
+    i32 1, label %a
+    i32 9, label %b
+    i32 17, label %c
+    i32 60, label %d
+  ]
+
+a:
+  store volatile i32 1, i32* %p
+  br label %exit
+
+b:
+  store volatile i32 2, i32* %p
+  br label %exit
+
+c:
+  store volatile i32 3, i32* %p
+  br label %exit
+
+d:
+  store volatile i32 4, i32* %p
+  br label %exit
+
+exit:
+  ret void
+}
+
+; NATIVE-LABEL: two_dests:
+; NATIVE-NOT:   bt{{[lq]}}
+; NATIVE:       retq
+; BC-LABEL:     two_dests:
+; BC:           bt{{[lq]}}
+
+define void @two_dests(i32 %x, i32* %p) #0 {
+entry:
+  switch i32 %x, label %exit [
+    i32 1, label %a
+    i32 9, label %b
+    i32 17, label %a
+    i32 40, label %b
+  ]
+
+a:
+  store volatile i32 1, i32* %p
+  br label %exit
+
+b:
+  store volatile i32 2, i32* %p
+  br label %exit
+
+exit:
+  ret void
+}
+
+attributes #0 = { "no-jump-tables"="true" }
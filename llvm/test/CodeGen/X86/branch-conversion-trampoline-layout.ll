@@ -0,0 +1,94 @@
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion < %s | FileCheck %s --check-prefix=CREATION
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion -x86-bc-trampoline-layout=profile < %s | FileCheck %s --check-prefix=PROFILE
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion -x86-bc-trampoline-layout=profile -function-sections -filetype=obj < %s | llvm-objdump -d - | FileCheck %s --check-prefix=PROFILE-OBJ
+
+;; The loop back-edge trampoline is by far the hottest trampoline of the
+;; function. With the default layout it ends up at the far end of the
+;; trampoline region (it is created last), away from the loop body. With the
+;; profile-guided layout it is packed right in front of the function body, so
+;; the hot path touches the same cache line as the function entry.
+
+; CREATION-LABEL: hot_loop:
+; CREATION:       jmp .LBB0_0
+; CREATION-NEXT:  .LBB0_{{[0-9]+}}: {{.*}}in Loop
+; CREATION-NEXT:  jmp .LBB0_1
+
+; PROFILE-LABEL:  hot_loop:
+; PROFILE:        jmp .LBB0_0
+; PROFILE-NEXT:   .LBB0_{{[0-9]+}}:
+; PROFILE-NEXT:   jmp .LBB0_2
+; PROFILE:        .LBB0_{{[0-9]+}}: {{.*}}in Loop
+; PROFILE-NEXT:   jmp .LBB0_1
+; PROFILE-NEXT:   .LBB0_0:
+
+define void @hot_loop(i32* %p, i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %inc, %loop ]
+  %gep = getelementptr inbounds i32, i32* %p, i32 %i
+  store i32 %i, i32* %gep
+  %inc = add nsw i32 %i, 1
+  %cmp = icmp slt i32 %inc, %n
+  br i1 %cmp, label %loop, label %exit, !prof !0
+
+exit:
+  ret void
+}
+
+!0 = !{!"branch_weights", i32 1000, i32 1}
+
+;; The hot path of @checked_loop passes the fall-through trampolines of the four
+;; checks, the loop entry and back-edge and the exit, while the trampolines to
+;; %fail stay cold. The profile-guided layout packs the hot ones into the 35
+;; bytes in front of the entry block at 0x75, with the back-edge right before
+;; it, so that they share the cache line 0x40-0x7f with the function entry.
+
+; PROFILE-OBJ-LABEL: checked_loop:
+; PROFILE-OBJ:       {{^ +}}52: e9 {{.*}} <checked_loop+0xe0>
+; PROFILE-OBJ-NEXT:  {{^ +}}57: e9 {{.*}} <checked_loop+0xd4>
+; PROFILE-OBJ-NEXT:  {{^ +}}5c: e9 {{.*}} <checked_loop+0xfd>
+; PROFILE-OBJ-NEXT:  {{^ +}}61: e9 {{.*}} <checked_loop+0xbc>
+; PROFILE-OBJ-NEXT:  {{^ +}}66: e9 {{.*}} <checked_loop+0xa4>
+; PROFILE-OBJ-NEXT:  {{^ +}}6b: e9 {{.*}} <checked_loop+0x8d>
+; PROFILE-OBJ-NEXT:  {{^ +}}70: e9 {{.*}} <checked_loop+0xe0>
+; PROFILE-OBJ-NEXT:  {{^ +}}75: {{.*}} pushq
+; PROFILE-OBJ:       {{^ +}}e0: {{.*}} movl
+
+declare void @cold()
+
+define void @checked_loop(i32* %p, i32 %n, i32 %a, i32 %b, i32 %c, i32 %d) {
+entry:
+  %ca = icmp eq i32 %a, 0
+  br i1 %ca, label %fail, label %check_b, !prof !1
+
+check_b:
+  %cb = icmp eq i32 %b, 0
+  br i1 %cb, label %fail, label %check_c, !prof !1
+
+check_c:
+  %cc = icmp eq i32 %c, 0
+  br i1 %cc, label %fail, label %check_d, !prof !1
+
+check_d:
+  %cd = icmp eq i32 %d, 0
+  br i1 %cd, label %fail, label %loop, !prof !1
+
+loop:
+  %i = phi i32 [ 0, %check_d ], [ %inc, %loop ]
+  %gep = getelementptr inbounds i32, i32* %p, i32 %i
+  store i32 %i, i32* %gep
+  %inc = add nsw i32 %i, 1
+  %cmp = icmp slt i32 %inc, %n
+  br i1 %cmp, label %loop, label %exit, !prof !0
+
+fail:
+  call void @cold()
+  br label %exit
+
+exit:
+  ret void
+}
+
+!1 = !{!"branch_weights", i32 1, i32 1000}
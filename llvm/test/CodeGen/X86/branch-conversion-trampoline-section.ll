@@ -0,0 +1,53 @@
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion -x86-bc-trampoline-section=.text.bcv_tramp < %s | FileCheck %s
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion -x86-bc-trampoline-section=.text.bcv_tramp -x86-bc-trampoline-section-per-function -x86-bc-trampoline-align=64 < %s | FileCheck %s --check-prefix=PERFN
+
+;; The trampolines are emitted into their own section, so the function no
+;; longer starts with a jump over them. Functions in a COMDAT get a section
+;; of their own in the same group.
+
+; CHECK-LABEL:  cond:
+; CHECK-NOT:    jmp
+; CHECK:        .section .text.bcv_tramp,"ax",@progbits
+; CHECK-NEXT:   .p2align 4
+; CHECK:        .text
+; CHECK-NEXT:   # %bb.0: {{.*}}# %entry
+; CHECK:        callq foo
+; CHECK:        .Lfunc_end0:
+
+; CHECK-LABEL:  inl:
+; CHECK:        .section .text.bcv_tramp.inl,"axG",@progbits,inl,comdat
+
+; PERFN-LABEL:  cond:
+; PERFN:        .section .text.bcv_tramp.cond,"ax",@progbits
+; PERFN-NEXT:   .p2align 6
+; PERFN:        .text
+
+declare void @foo()
+
+define void @cond(i32 %a) {
+entry:
+  %c = icmp eq i32 %a, 0
+  br i1 %c, label %then, label %exit
+
+then:
+  call void @foo()
+  br label %exit
+
+exit:
+  ret void
+}
+
+$inl = comdat any
+
+define linkonce_odr void @inl(i32 %a) comdat {
+entry:
+  %c = icmp eq i32 %a, 0
+  br i1 %c, label %then, label %exit
+
+then:
+  call void @foo()
+  br label %exit
+
+exit:
+  ret void
+}
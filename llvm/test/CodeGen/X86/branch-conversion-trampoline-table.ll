@@ -0,0 +1,111 @@
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion -x86-bc-trampoline-table < %s | FileCheck %s
+; RUN: llc -mtriple=x86_64-pc-linux -relocation-model=pic -x86-branch-conversion -x86-bc-trampoline-table < %s | FileCheck %s --check-prefix=PIC
+; RUN: not llc -mtriple=x86_64-pc-linux -x86-branch-conversion -x86-bc-trampoline-table -x86-bc-short-jumps < %s 2>&1 | FileCheck %s --check-prefix=SHORT
+
+;; Every trampoline block gets a range in bcv_tramp_ranges, and every
+;; reference into or out of the trampoline region a fixup in bcv_tramp_fixups:
+;; {site, base, target, site range, target range, width}. Fixups patch the
+;; rel32 at the end of an instruction, so short jumps are rejected.
+
+; CHECK-LABEL:  cond:
+; CHECK:        .section .text.bcv_tramp,"ax",@progbits
+; CHECK:        [[T0:.LBB0_[0-9]+]]: # Block address taken
+; CHECK-NEXT:   jmp [[THEN:.LBB0_[0-9]+]]
+; CHECK-NEXT:   [[F0:.Lbcv_fixup[0-9]+]]:
+; CHECK:        [[END:.Lbcv_tramp_end[0-9]+]]:
+; CHECK-NEXT:   .text
+; CHECK:        leaq [[T1:.LBB0_[0-9]+]](%rip), %r11
+; CHECK-NEXT:   [[F1:.Lbcv_fixup[0-9]+]]:
+; CHECK:        .section bcv_tramp_ranges,"aw",@progbits
+; CHECK-NEXT:   .p2align 3
+; CHECK-NEXT:   [[R0:.Lbcv_range[0-9]+]]:
+; CHECK-NEXT:   .quad [[T0]]
+; CHECK:        .quad [[END]]
+; CHECK:        .section bcv_tramp_fixups,"aw",@progbits
+; CHECK-NEXT:   .p2align 3
+; CHECK-NEXT:   .quad [[F0]]-4
+; CHECK-NEXT:   .quad [[F0]]
+; CHECK-NEXT:   .quad [[THEN]]
+; CHECK-NEXT:   .quad [[R0]]
+; CHECK-NEXT:   .quad 0
+; CHECK-NEXT:   .quad 4
+; CHECK:        .quad [[F1]]-4
+; CHECK-NEXT:   .quad [[F1]]
+; CHECK-NEXT:   .quad [[T1]]
+; CHECK-NEXT:   .quad 0
+; CHECK-NEXT:   .quad .Lbcv_range{{[0-9]+}}
+; CHECK-NEXT:   .quad 4
+
+;; Jump table entries are fixups without a base, or relative to the table with PIC
+
+; CHECK-LABEL:  sw:
+; CHECK:        .LJTI1_0:
+; CHECK-NEXT:   .quad [[JT0:.LBB1_[0-9]+]]
+; CHECK:        .section bcv_tramp_fixups,"aw",@progbits
+; CHECK:        .quad .LJTI1_0
+; CHECK-NEXT:   .quad 0
+; CHECK-NEXT:   .quad [[JT0]]
+; CHECK-NEXT:   .quad 0
+; CHECK-NEXT:   .quad .Lbcv_range{{[0-9]+}}
+; CHECK-NEXT:   .quad 8
+
+; PIC-LABEL:    sw:
+; PIC:          .LJTI1_0:
+; PIC-NEXT:     .long [[JT0:.LBB1_[0-9]+]]-.LJTI1_0
+; PIC:          .section bcv_tramp_fixups,"aw",@progbits
+; PIC:          .quad .LJTI1_0
+; PIC-NEXT:     .quad .LJTI1_0
+; PIC-NEXT:     .quad [[JT0]]
+; PIC-NEXT:     .quad 0
+; PIC-NEXT:     .quad .Lbcv_range{{[0-9]+}}
+; PIC-NEXT:     .quad 4
+
+; SHORT: -x86-bc-trampoline-table does not support -x86-bc-short-jumps
+
+declare void @foo()
+
+define void @cond(i32 %a) {
+entry:
+  %c = icmp eq i32 %a, 0
+  br i1 %c, label %then, label %exit
+
+then:
+  call void @foo()
+  br label %exit
+
+exit:
+  ret void
+}
+
+define i32 @sw(i32 %x) {
+entry:
+  switch i32 %x, label %def [
+    i32 0, label %a
+    i32 1, label %b
+    i32 2, label %c
+    i32 3, label %d
+    i32 4, label %e
+  ]
+
+a:
+  br label %exit
+
+b:
+  br label %exit
+
+c:
+  br label %exit
+
+d:
+  br label %exit
+
+e:
+  br label %exit
+
+def:
+  br label %exit
+
+exit:
+  %r = phi i32 [ 10, %a ], [ 21, %b ], [ 32, %c ], [ 43, %d ], [ 54, %e ], [ 65, %def ]
+  ret i32 %r
+}
@@ -0,0 +1,88 @@
+; RUN: llc -mtriple=x86_64-pc-linux -x86-branch-conversion -x86-bc-whole-program-layout < %s | FileCheck %s
+
+;; The whole-program layout moves the converted functions to the end of the
+;; module: the roots of the converted call graph first, hottest first, each
+;; followed by its callees, hottest first. All trampolines go into one
+;; section, so no function jumps over its trampolines.
+
+; CHECK-LABEL:  plain:
+; CHECK-LABEL:  other:
+; CHECK-NOT:    jmp
+; CHECK:        .section .text.bcv_tramp,"ax",@progbits
+; CHECK-LABEL:  top:
+; CHECK:        .section .text.bcv_tramp,"ax",@progbits
+; CHECK-LABEL:  leaf_b:
+; CHECK-LABEL:  leaf_a:
+
+declare void @foo()
+
+define void @leaf_a(i32 %a) !prof !0 {
+entry:
+  %c = icmp eq i32 %a, 0
+  br i1 %c, label %then, label %exit
+
+then:
+  call void @foo()
+  br label %exit
+
+exit:
+  ret void
+}
+
+define void @plain(i32 %a) "no-branch-shadow-protect" {
+entry:
+  %c = icmp eq i32 %a, 0
+  br i1 %c, label %then, label %exit
+
+then:
+  call void @foo()
+  br label %exit
+
+exit:
+  ret void
+}
+
+define void @leaf_b(i32 %a) !prof !1 {
+entry:
+  %c = icmp eq i32 %a, 0
+  br i1 %c, label %then, label %exit
+
+then:
+  call void @foo()
+  br label %exit
+
+exit:
+  ret void
+}
+
+define void @top(i32 %a) !prof !2 {
+entry:
+  %c = icmp eq i32 %a, 0
+  br i1 %c, label %then, label %exit
+
+then:
+  call void @leaf_a(i32 %a)
+  call void @leaf_b(i32 %a)
+  br label %exit
+
+exit:
+  ret void
+}
+
+define void @other(i32 %a) !prof !3 {
+entry:
+  %c = icmp eq i32 %a, 0
+  br i1 %c, label %then, label %exit
+
+then:
+  call void @foo()
+  br label %exit
+
+exit:
+  ret void
+}
+
+!0 = !{!"function_entry_count", i64 50}
+!1 = !{!"function_entry_count", i64 500}
+!2 = !{!"function_entry_count", i64 10}
+!3 = !{!"function_entry_count", i64 100}
@@ -766,6 +766,8 @@ static std::unique_ptr<LTO> createLTO() {
   Conf.Options.DataSections = true;
 
   Conf.MAttrs = MAttrs;
+  if (!options::extra.empty())
+    Conf.BackendOptions.assign(options::extra.begin() + 1, options::extra.end());
   Conf.RelocModel = RelocationModel;
   Conf.CGOptLevel = getCGOptLevel();
   Conf.DisableVerify = options::DisableVerify;
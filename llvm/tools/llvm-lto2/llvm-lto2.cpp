@@ -146,7 +146,17 @@ static int usage() {
 }
 
 static int run(int argc, char **argv) {
-  cl::ParseCommandLineOptions(argc, argv, "Resolution-based LTO test harness");
+  // Like a linker, take backend options as -mllvm <option>. They are parsed
+  // along with the others, and recorded for the ThinLTO cache key.
+  std::vector<std::string> BackendOptions;
+  std::vector<const char *> Args(1, argv[0]);
+  for (int I = 1; I < argc; ++I) {
+    if (StringRef(argv[I]) == "-mllvm" && I + 1 < argc)
+      BackendOptions.push_back(argv[++I]);
+    Args.push_back(argv[I]);
+  }
+  cl::ParseCommandLineOptions(Args.size(), Args.data(),
+                              "Resolution-based LTO test harness");
 
   // FIXME: Workaround PR30396 which means that a symbol can appear
   // more than once if it is defined in module-level assembly and
@@ -195,6 +205,7 @@ static int run(int argc, char **argv) {
   Conf.CPU = MCPU;
   Conf.Options = InitTargetOptionsFromCodeGenFlags();
   Conf.MAttrs = MAttrs;
+  Conf.BackendOptions = BackendOptions;
   if (auto RM = getRelocModel())
     Conf.RelocModel = *RM;
   Conf.CodeModel = getCodeModel();
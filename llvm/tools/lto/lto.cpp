@@ -73,6 +73,9 @@ static bool initialized = false;
 // Holds the command-line option parsing state of the LTO module.
 static bool parsedOptions = false;
 
+// Options passed with thinlto_debug_options(), part of the ThinLTO cache key
+static std::vector<std::string> ThinLTOBackendOptions;
+
 static LLVMContext *LTOContext = nullptr;
 
 struct LTOToolDiagnosticHandler : public DiagnosticHandler {
@@ -505,7 +508,10 @@ void thinlto_codegen_add_module(thinlto_code_gen_t cg, const char *Identifier,
   unwrap(cg)->addModule(Identifier, StringRef(Data, Length));
 }
 
-void thinlto_codegen_process(thinlto_code_gen_t cg) { unwrap(cg)->run(); }
+void thinlto_codegen_process(thinlto_code_gen_t cg) {
+  unwrap(cg)->setBackendOptions(ThinLTOBackendOptions);
+  unwrap(cg)->run();
+}
 
 unsigned int thinlto_module_get_num_objects(thinlto_code_gen_t cg) {
   return unwrap(cg)->getProducedBinaries().size();
@@ -542,8 +548,10 @@ void thinlto_debug_options(const char *const *options, int number) {
   // if options were requested, set them
   if (number && options) {
     std::vector<const char *> CodegenArgv(1, "libLTO");
-    for (auto Arg : ArrayRef<const char *>(options, number))
+    for (auto Arg : ArrayRef<const char *>(options, number)) {
       CodegenArgv.push_back(Arg);
+      ThinLTOBackendOptions.push_back(Arg);
+    }
     cl::ParseCommandLineOptions(CodegenArgv.size(), CodegenArgv.data());
   }
 }
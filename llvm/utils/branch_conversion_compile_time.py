@@ -0,0 +1,120 @@
+#!/usr/bin/env python
+"""Compile-time benchmark for the X86 branch conversion pass.
+
+This generates synthetic functions with a large number of basic blocks and
+times llc on them with and without -x86-branch-conversion. The shapes mimic
+the generated code that makes the pass expensive:
+
+  errexit       A long chain of checks that all branch forward to one error
+                exit, so many sources share a single skip lane destination.
+  ladder        Every block branches forward to a block far ahead, keeping a
+                large number of distinct skip lanes alive at the same time.
+  statemachine  A dispatch loop over a compare chain of states, each state
+                jumping back to the loop header.
+
+Example:
+  branch_conversion_compile_time.py --llc build/bin/llc --blocks 10000 100000
+"""
+
+from __future__ import print_function
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def gen_errexit(blocks):
+  lines = ["define i32 @f(i32* %p) {", "entry:", "  br label %b0"]
+  for i in range(blocks):
+    lines += ["b%d:" % i,
+              "  %%v%d = load volatile i32, i32* %%p" % i,
+              "  %%c%d = icmp eq i32 %%v%d, %d" % (i, i, i),
+              "  br i1 %%c%d, label %%error, label %%b%d" % (i, i + 1)]
+  lines += ["b%d:" % blocks, "  ret i32 0",
+            "error:", "  ret i32 -1", "}"]
+  return lines
+
+
+def gen_ladder(blocks, span=64):
+  lines = ["define i32 @f(i32* %p) {", "entry:", "  br label %b0"]
+  for i in range(blocks):
+    target = min(i + span, blocks)
+    lines += ["b%d:" % i,
+              "  %%v%d = load volatile i32, i32* %%p" % i,
+              "  store volatile i32 %d, i32* %%p" % i,
+              "  %%c%d = icmp eq i32 %%v%d, %d" % (i, i, i),
+              "  br i1 %%c%d, label %%b%d, label %%b%d" % (i, target, i + 1)]
+  lines += ["b%d:" % blocks, "  ret i32 0", "}"]
+  return lines
+
+
+def gen_statemachine(blocks):
+  states = max(blocks // 2, 1)
+  lines = ["define i32 @f(i32* %p) {", "entry:", "  br label %loop",
+           "loop:", "  %s = load volatile i32, i32* %p",
+           "  br label %s0"]
+  for i in range(states):
+    lines += ["s%d:" % i,
+              "  %%c%d = icmp eq i32 %%s, %d" % (i, i),
+              "  br i1 %%c%d, label %%a%d, label %%s%d" % (i, i, i + 1),
+              "a%d:" % i,
+              "  store volatile i32 %d, i32* %%p" % ((i * 7 + 1) % states),
+              "  br label %loop"]
+  lines += ["s%d:" % states, "  ret i32 0", "}"]
+  return lines
+
+
+GENERATORS = {
+  'errexit': gen_errexit,
+  'ladder': gen_ladder,
+  'statemachine': gen_statemachine,
+}
+
+
+def time_llc(llc, ir_file, extra_args):
+  cmd = [llc, '-O2', '-mtriple=x86_64-pc-linux', '-o', os.devnull, ir_file]
+  cmd += extra_args
+  start = time.time()
+  subprocess.check_call(cmd)
+  return time.time() - start
+
+
+def main():
+  parser = argparse.ArgumentParser(
+      description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+  parser.add_argument('--llc', default='llc', help="Path to llc")
+  parser.add_argument('--blocks', type=int, nargs='+',
+                      default=[10000, 25000, 50000, 100000],
+                      help="Number of blocks of the generated functions")
+  parser.add_argument('--shape', choices=sorted(GENERATORS.keys()) + ['all'],
+                      default='all', help="Shape of the generated functions")
+  parser.add_argument('--llc-arg', action='append', default=[],
+                      help="Extra argument for the converting llc run, "
+                           "e.g. --llc-arg=-x86-bc-skip-lanes=collapse")
+  args = parser.parse_args()
+
+  shapes = sorted(GENERATORS.keys()) if args.shape == 'all' else [args.shape]
+
+  print("%-14s %8s %12s %13s %8s" % ("shape", "blocks", "baseline (s)",
+                                     "converted (s)", "ratio"))
+  for shape in shapes:
+    for blocks in args.blocks:
+      fd, ir_file = tempfile.mkstemp(suffix='.ll')
+      try:
+        with os.fdopen(fd, 'w') as f:
+          f.write("\n".join(GENERATORS[shape](blocks)) + "\n")
+        base = time_llc(args.llc, ir_file, [])
+        conv = time_llc(args.llc, ir_file,
+                        ['-x86-branch-conversion'] + args.llc_arg)
+      finally:
+        os.remove(ir_file)
+      print("%-14s %8d %12.2f %13.2f %8.2f" % (shape, blocks, base, conv,
+                                               conv / base if base else 0))
+      sys.stdout.flush()
+
+
+if __name__ == '__main__':
+  main()
@@ -0,0 +1,242 @@
+/*
+ * Copyright: Secure Systems Group, Aalto University https://ssg.aalto.fi/
+ * This code is released under Apache 2.0 license
+ */
+
+#include "bcv_tramp.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <sgx_trts.h>
+
+/* Emitted by the compiler, bounded by the linker */
+extern const struct bcv_range __start_bcv_tramp_ranges[] __attribute__((weak));
+extern const struct bcv_range __stop_bcv_tramp_ranges[] __attribute__((weak));
+extern const struct bcv_fixup __start_bcv_tramp_fixups[] __attribute__((weak));
+extern const struct bcv_fixup __stop_bcv_tramp_fixups[] __attribute__((weak));
+
+/* Defined by bcv_tramp.lds */
+extern uint8_t __bcv_tramp_start[] __attribute__((weak));
+extern uint8_t __bcv_tramp_end[] __attribute__((weak));
+extern uint8_t __bcv_tramp_shadow[] __attribute__((weak));
+extern uint8_t __bcv_tramp_writable_start[] __attribute__((weak));
+extern uint8_t __bcv_tramp_writable_end[] __attribute__((weak));
+
+/* Fill for the unused end of a buffer */
+#define BCV_TRAMP_INT3 0xcc
+
+/* Random numbers fetched at once while shuffling */
+#define BCV_TRAMP_RAND_BATCH 64
+
+static struct {
+    const struct bcv_range *ranges;
+    size_t num_ranges;
+    const struct bcv_fixup *fixups;
+    size_t num_fixups;
+    uint8_t *buffers[2];
+    size_t size;
+    /* Offset of every range in either buffer */
+    uint64_t *offsets[2];
+    uint32_t *order;
+    int live;
+    int initialized;
+    int prepared;
+} bcv_tramp;
+
+/*
+ * The address of addr, which lies in range (or outside the trampolines if
+ * range is NULL), in the given buffer.
+ */
+static uint64_t bcv_tramp_relocate(const struct bcv_range *range, uint64_t addr, int buffer)
+{
+    size_t index;
+
+    if (range == NULL)
+        return addr;
+
+    index = (size_t)(range - bcv_tramp.ranges);
+    return (uint64_t)bcv_tramp.buffers[buffer] + bcv_tramp.offsets[buffer][index] + (addr - range->start);
+}
+
+/* Point the field of fixup at its target as laid out in the given buffer */
+static void bcv_tramp_apply(const struct bcv_fixup *fixup, int buffer)
+{
+    uint64_t site = bcv_tramp_relocate(fixup->site_range, fixup->site, buffer);
+    uint64_t value = bcv_tramp_relocate(fixup->target_range, fixup->target, buffer);
+
+    if (fixup->base != 0)
+        value -= bcv_tramp_relocate(fixup->site_range, fixup->base, buffer);
+
+    if (fixup->width == 4) {
+        uint32_t value32 = (uint32_t)value;
+        memcpy((void *)site, &value32, sizeof(value32));
+    } else {
+        memcpy((void *)site, &value, sizeof(value));
+    }
+}
+
+/* Whether the size bytes at addr lie in the segment that bcv_tramp.lds makes writable */
+static int bcv_tramp_writable(uint64_t addr, uint64_t size)
+{
+    return addr >= (uint64_t)__bcv_tramp_writable_start && addr <= (uint64_t)__bcv_tramp_writable_end &&
+           size <= (uint64_t)__bcv_tramp_writable_end - addr;
+}
+
+/* Free the tables of bcv_tramp_init() */
+static void bcv_tramp_free(void)
+{
+    free(bcv_tramp.offsets[0]);
+    free(bcv_tramp.offsets[1]);
+    free(bcv_tramp.order);
+    bcv_tramp.offsets[0] = NULL;
+    bcv_tramp.offsets[1] = NULL;
+    bcv_tramp.order = NULL;
+}
+
+/* Fisher-Yates shuffle of the range order */
+static int bcv_tramp_shuffle(void)
+{
+    uint64_t rand[BCV_TRAMP_RAND_BATCH];
+    size_t available = 0;
+    size_t i;
+
+    for (i = bcv_tramp.num_ranges; i > 1; i--) {
+        size_t j;
+        uint32_t tmp;
+
+        if (available == 0) {
+            if (sgx_read_rand((unsigned char *)rand, sizeof(rand)) != SGX_SUCCESS)
+                return BCV_TRAMP_ERR_RAND;
+            available = BCV_TRAMP_RAND_BATCH;
+        }
+
+        j = (size_t)(rand[--available] % i);
+        tmp = bcv_tramp.order[i - 1];
+        bcv_tramp.order[i - 1] = bcv_tramp.order[j];
+        bcv_tramp.order[j] = tmp;
+    }
+
+    return BCV_TRAMP_OK;
+}
+
+int bcv_tramp_init(void)
+{
+    size_t i;
+
+    if (bcv_tramp.initialized)
+        return BCV_TRAMP_OK;
+
+    bcv_tramp.ranges = __start_bcv_tramp_ranges;
+    bcv_tramp.num_ranges = (size_t)(__stop_bcv_tramp_ranges - __start_bcv_tramp_ranges);
+    if (bcv_tramp.num_ranges == 0)
+        return BCV_TRAMP_OK;
+
+    bcv_tramp.fixups = __start_bcv_tramp_fixups;
+    bcv_tramp.num_fixups = (size_t)(__stop_bcv_tramp_fixups - __start_bcv_tramp_fixups);
+
+    if (__bcv_tramp_start == NULL || __bcv_tramp_shadow == NULL || __bcv_tramp_writable_start == NULL)
+        return BCV_TRAMP_ERR_LAYOUT;
+    bcv_tramp.buffers[0] = __bcv_tramp_start;
+    bcv_tramp.buffers[1] = __bcv_tramp_shadow;
+    bcv_tramp.size = (size_t)(__bcv_tramp_end - __bcv_tramp_start);
+
+    /* Fail before writing anything if a page that would be patched is not writable */
+    if (!bcv_tramp_writable((uint64_t)bcv_tramp.buffers[0], bcv_tramp.size) ||
+        !bcv_tramp_writable((uint64_t)bcv_tramp.buffers[1], bcv_tramp.size))
+        return BCV_TRAMP_ERR_PERM;
+    for (i = 0; i < bcv_tramp.num_fixups; i++)
+        if (bcv_tramp.fixups[i].site_range == NULL &&
+            !bcv_tramp_writable(bcv_tramp.fixups[i].site, bcv_tramp.fixups[i].width))
+            return BCV_TRAMP_ERR_PERM;
+
+    bcv_tramp.offsets[0] = (uint64_t *)malloc(bcv_tramp.num_ranges * sizeof(uint64_t));
+    bcv_tramp.offsets[1] = (uint64_t *)malloc(bcv_tramp.num_ranges * sizeof(uint64_t));
+    bcv_tramp.order = (uint32_t *)malloc(bcv_tramp.num_ranges * sizeof(uint32_t));
+    if (bcv_tramp.offsets[0] == NULL || bcv_tramp.offsets[1] == NULL || bcv_tramp.order == NULL) {
+        bcv_tramp_free();
+        return BCV_TRAMP_ERR_NOMEM;
+    }
+
+    /* The trampolines start out in the first buffer, as linked */
+    for (i = 0; i < bcv_tramp.num_ranges; i++) {
+        const struct bcv_range *range = &bcv_tramp.ranges[i];
+
+        if (range->start < (uint64_t)__bcv_tramp_start || range->end > (uint64_t)__bcv_tramp_end ||
+            range->start > range->end) {
+            bcv_tramp_free();
+            return BCV_TRAMP_ERR_LAYOUT;
+        }
+
+        bcv_tramp.offsets[0][i] = range->start - (uint64_t)__bcv_tramp_start;
+        bcv_tramp.order[i] = (uint32_t)i;
+    }
+
+    bcv_tramp.live = 0;
+    bcv_tramp.prepared = 0;
+    bcv_tramp.initialized = 1;
+
+    return bcv_tramp_rerandomize();
+}
+
+int bcv_tramp_prepare(void)
+{
+    int next = !bcv_tramp.live;
+    uint64_t pos = 0;
+    size_t i;
+    int ret;
+
+    if (!bcv_tramp.initialized)
+        return BCV_TRAMP_ERR_STATE;
+
+    ret = bcv_tramp_shuffle();
+    if (ret != BCV_TRAMP_OK)
+        return ret;
+
+    /* Copy the blocks over in their new order, each one moves as a whole */
+    for (i = 0; i < bcv_tramp.num_ranges; i++) {
+        uint32_t index = bcv_tramp.order[i];
+        const struct bcv_range *range = &bcv_tramp.ranges[index];
+        uint64_t len = range->end - range->start;
+
+        memcpy(bcv_tramp.buffers[next] + pos, bcv_tramp.buffers[bcv_tramp.live] + bcv_tramp.offsets[bcv_tramp.live][index],
+               (size_t)len);
+        bcv_tramp.offsets[next][index] = pos;
+        pos += len;
+    }
+    memset(bcv_tramp.buffers[next] + pos, BCV_TRAMP_INT3, (size_t)(bcv_tramp.size - pos));
+
+    /* Fixups inside the trampolines only touch the new buffer */
+    for (i = 0; i < bcv_tramp.num_fixups; i++)
+        if (bcv_tramp.fixups[i].site_range != NULL)
+            bcv_tramp_apply(&bcv_tramp.fixups[i], next);
+
+    bcv_tramp.prepared = 1;
+    return BCV_TRAMP_OK;
+}
+
+int bcv_tramp_commit(void)
+{
+    int next = !bcv_tramp.live;
+    size_t i;
+
+    if (!bcv_tramp.prepared)
+        return BCV_TRAMP_ERR_STATE;
+
+    for (i = 0; i < bcv_tramp.num_fixups; i++)
+        if (bcv_tramp.fixups[i].site_range == NULL)
+            bcv_tramp_apply(&bcv_tramp.fixups[i], next);
+
+    bcv_tramp.live = next;
+    bcv_tramp.prepared = 0;
+    return BCV_TRAMP_OK;
+}
+
+int bcv_tramp_rerandomize(void)
+{
+    int ret = bcv_tramp_prepare();
+
+    if (ret != BCV_TRAMP_OK)
+        return ret;
+    return bcv_tramp_commit();
+}
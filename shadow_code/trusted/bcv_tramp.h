@@ -0,0 +1,92 @@
+/*
+ * Copyright: Secure Systems Group, Aalto University https://ssg.aalto.fi/
+ * This code is released under Apache 2.0 license
+ */
+
+#ifndef _BCV_TRAMP_H_
+#define _BCV_TRAMP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*
+ * Run-time permutation of the trampolines created by branch conversion.
+ *
+ * Compile the enclave with -mllvm -x86-bc-trampoline-table and link it with
+ * bcv_tramp.lds, which collects the trampolines into the .bcv_tramp region
+ * and reserves an equally large shadow region behind it. The two regions are
+ * used as a double buffer: the trampolines run from the live one, while
+ * bcv_tramp_prepare() lays them out in random order in the other. Only
+ * bcv_tramp_commit() touches code that may be running, it points the
+ * references from the function bodies and jump tables at the new layout.
+ *
+ * Both regions and the code holding the references have to be writable, which
+ * bcv_tramp.lds arranges with an RWX text segment. None of the functions are
+ * thread-safe.
+ */
+
+/* One trampoline block, see bcv_tramp_ranges */
+struct bcv_range {
+    uint64_t start;
+    uint64_t end;
+};
+
+/*
+ * A reference into or out of a trampoline block, see bcv_tramp_fixups. The
+ * field of width bytes at site holds target - base, or target if base is 0.
+ * site_range and target_range are the blocks containing site (and base) and
+ * target, NULL for addresses outside the trampolines.
+ */
+struct bcv_fixup {
+    uint64_t site;
+    uint64_t base;
+    uint64_t target;
+    const struct bcv_range *site_range;
+    const struct bcv_range *target_range;
+    uint64_t width;
+};
+
+#define BCV_TRAMP_OK 0
+/* A trampoline lies outside the .bcv_tramp region, or bcv_tramp.lds is missing */
+#define BCV_TRAMP_ERR_LAYOUT 1
+#define BCV_TRAMP_ERR_NOMEM 2
+#define BCV_TRAMP_ERR_RAND 3
+/* Not initialized, or commit without prepare */
+#define BCV_TRAMP_ERR_STATE 4
+/* Something to patch lies outside the writable segment of bcv_tramp.lds */
+#define BCV_TRAMP_ERR_PERM 5
+
+/*
+ * Read the tables and give the trampolines their first random layout.
+ * Returns BCV_TRAMP_OK without doing anything if there are no tables, and
+ * fails without writing anything if the enclave was not linked with
+ * bcv_tramp.lds.
+ */
+int bcv_tramp_init(void);
+
+/*
+ * Lay out the trampolines in a new random order in the buffer that is not
+ * live. Costs O(trampoline bytes + fixups), does not touch running code.
+ */
+int bcv_tramp_prepare(void);
+
+/*
+ * Switch to the layout of the last bcv_tramp_prepare() by patching the
+ * references from outside the trampolines, O(fixups). The old buffer stays
+ * intact until the next prepare, so threads still running in it return
+ * through it safely.
+ */
+int bcv_tramp_commit(void);
+
+/* bcv_tramp_prepare() followed by bcv_tramp_commit() */
+int bcv_tramp_rerandomize(void);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_BCV_TRAMP_H_ */
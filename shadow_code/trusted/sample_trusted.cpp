@@ -12,6 +12,7 @@
 #include <stdint.h>
 #include <stdint.h>
 #include "../shared/common.h"
+#include "bcv_tramp.h"
 
 /* Ignore CannotResolve errors for generated files. */
 #pragma clang diagnostic push
@@ -22,8 +23,13 @@
 #define VICTIM_FUNC(x) e_##x
 #include "../shared/victim_shared.c"
 
-void ecall_setup()
+int ecall_setup()
 {
+    /* Give the trampolines a random layout before the victims are located */
+    int ret = bcv_tramp_init();
+    if (ret != BCV_TRAMP_OK)
+        return ret;
+
     ocall_set_branch_victim_jne(
             static_cast<uint64_t>((long) &e_victim_jne),
             static_cast<uint64_t>((long) e_get_victim_jne_src()),
@@ -36,6 +42,13 @@ void ecall_setup()
             static_cast<uint64_t>((long) e_get_victim_ret_if()),
             static_cast<uint64_t>((long) e_get_victim_ret_else())
     );
+
+    return BCV_TRAMP_OK;
+}
+
+int ecall_bcv_rerandomize()
+{
+    return bcv_tramp_rerandomize();
 }
 
 void ecall_victim_jne(int number)
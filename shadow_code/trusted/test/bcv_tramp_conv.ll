@@ -0,0 +1,56 @@
+;; Converted code for bcv_tramp_test.c: a switch lowered to a jump table,
+;; whose entries point into the trampolines, and a loop with nested branches.
+
+define i32 @bcv_test_switch(i32 %x) {
+entry:
+  switch i32 %x, label %def [
+    i32 0, label %a
+    i32 1, label %b
+    i32 2, label %c
+    i32 3, label %d
+    i32 4, label %e
+  ]
+a:
+  br label %exit
+b:
+  br label %exit
+c:
+  br label %exit
+d:
+  br label %exit
+e:
+  br label %exit
+def:
+  br label %exit
+exit:
+  %r = phi i32 [ 10, %a ], [ 21, %b ], [ 32, %c ], [ 43, %d ], [ 54, %e ], [ 65, %def ]
+  ret i32 %r
+}
+
+define i32 @bcv_test_loop(i32 %n, i32 %k) {
+entry:
+  br label %head
+head:
+  %i = phi i32 [ 0, %entry ], [ %i1, %latch ]
+  %s = phi i32 [ 0, %entry ], [ %s2, %latch ]
+  %odd = and i32 %i, 1
+  %c = icmp eq i32 %odd, 0
+  br i1 %c, label %even, label %oddb
+even:
+  %s0 = add i32 %s, %k
+  br label %latch
+oddb:
+  %s1 = mul i32 %s, 3
+  %big = icmp sgt i32 %s1, 1000
+  br i1 %big, label %wrap, label %latch
+wrap:
+  %s3 = srem i32 %s1, 97
+  br label %latch
+latch:
+  %s2 = phi i32 [ %s0, %even ], [ %s1, %oddb ], [ %s3, %wrap ]
+  %i1 = add i32 %i, 1
+  %done = icmp sge i32 %i1, %n
+  br i1 %done, label %exit, label %head
+exit:
+  ret i32 %s2
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright: Secure Systems Group, Aalto University https://ssg.aalto.fi/
+ * This code is released under Apache 2.0 license
+ */
+
+/*
+ * Host test of the trampoline runtime. Like the enclave, the test is linked
+ * without the C library and with bcv_tramp.lds, so the runtime patches the
+ * code through the segment permissions of the linker script alone. Built
+ * with BCV_TEST_UNLINKED, the test is linked without the script instead and
+ * expects bcv_tramp_init() to fail without touching the code.
+ */
+
+#include "bcv_tramp.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <sgx_trts.h>
+
+#define BCV_TEST_ROUNDS 200
+#define BCV_TEST_HEAP_SIZE 65536
+
+/* Converted by branch conversion, see bcv_tramp_conv.ll */
+int bcv_test_switch(int x);
+int bcv_test_loop(int n, int k);
+
+#ifndef BCV_TEST_UNLINKED
+/* Defined by bcv_tramp.lds */
+extern uint8_t __bcv_tramp_start[];
+extern uint8_t __bcv_tramp_end[];
+extern uint8_t __bcv_tramp_shadow[];
+#endif
+
+static uint8_t heap[BCV_TEST_HEAP_SIZE] __attribute__((aligned(16)));
+static size_t heap_used;
+static uint64_t rand_state = 0x9e3779b97f4a7c15ull;
+
+/* No C library, so the test brings the little the runtime needs */
+void *malloc(size_t size)
+{
+    void *ptr;
+
+    size = (size + 15) & ~(size_t)15;
+    if (size > BCV_TEST_HEAP_SIZE - heap_used)
+        return NULL;
+    ptr = heap + heap_used;
+    heap_used += size;
+    return ptr;
+}
+
+void free(void *ptr)
+{
+    (void)ptr;
+}
+
+void *memcpy(void *dst, const void *src, size_t n)
+{
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+
+    while (n--)
+        *d++ = *s++;
+    return dst;
+}
+
+void *memset(void *dst, int c, size_t n)
+{
+    uint8_t *d = (uint8_t *)dst;
+
+    while (n--)
+        *d++ = (uint8_t)c;
+    return dst;
+}
+
+size_t strlen(const char *str)
+{
+    size_t len = 0;
+
+    while (str[len] != '\0')
+        len++;
+    return len;
+}
+
+sgx_status_t sgx_read_rand(unsigned char *rand, size_t length_in_bytes)
+{
+    while (length_in_bytes--) {
+        /* xorshift64, the test only needs different layouts */
+        rand_state ^= rand_state << 13;
+        rand_state ^= rand_state >> 7;
+        rand_state ^= rand_state << 17;
+        *rand++ = (unsigned char)rand_state;
+    }
+    return SGX_SUCCESS;
+}
+
+static void bcv_test_write(const char *str)
+{
+    long ret;
+
+    __asm__ volatile("syscall"
+                     : "=a"(ret)
+                     : "a"(1), "D"(2), "S"(str), "d"(strlen(str))
+                     : "rcx", "r11", "memory");
+    (void)ret;
+}
+
+/* Runs every path through the converted code */
+static uint64_t bcv_test_run(void)
+{
+    uint64_t hash = 0;
+    int i;
+
+    for (i = -2; i < 8; i++)
+        hash = hash * 31 + (uint64_t)bcv_test_switch(i);
+    for (i = 1; i < 40; i++)
+        hash = hash * 31 + (uint64_t)bcv_test_loop(i, i % 7);
+    return hash;
+}
+
+static int bcv_test_fail(const char *msg)
+{
+    bcv_test_write("bcv_tramp_test: ");
+    bcv_test_write(msg);
+    bcv_test_write("\n");
+    return 1;
+}
+
+int bcv_test_main(void)
+{
+    uint64_t expected = bcv_test_run();
+#ifdef BCV_TEST_UNLINKED
+    if (bcv_tramp_init() != BCV_TRAMP_ERR_LAYOUT)
+        return bcv_test_fail("init did not reject the default layout");
+    if (bcv_tramp_rerandomize() != BCV_TRAMP_ERR_STATE)
+        return bcv_test_fail("rerandomized without init");
+    if (bcv_test_run() != expected)
+        return bcv_test_fail("wrong result after the failed init");
+#else
+    uint8_t *buffers[2] = {__bcv_tramp_start, __bcv_tramp_shadow};
+    size_t size = (size_t)(__bcv_tramp_end - __bcv_tramp_start);
+    int round;
+
+    if (size == 0)
+        return bcv_test_fail("no trampolines in .bcv_tramp");
+    if (bcv_tramp_init() != BCV_TRAMP_OK)
+        return bcv_test_fail("init failed");
+
+    /*
+     * Every layout switches buffers, starting from the linked one. The code
+     * must not use the buffer that is no longer live, so fill it with INT3.
+     */
+    for (round = 1; round <= BCV_TEST_ROUNDS; round++) {
+        memset(buffers[(round + 1) % 2], 0xcc, size);
+        if (bcv_test_run() != expected)
+            return bcv_test_fail("wrong result after re-randomizing");
+        if (bcv_tramp_rerandomize() != BCV_TRAMP_OK)
+            return bcv_test_fail("re-randomizing failed");
+    }
+#endif
+    bcv_test_write("bcv_tramp_test: ok\n");
+    return 0;
+}
+
+__asm__(".globl _start\n"
+        "_start:\n"
+        "    xorl %ebp, %ebp\n"
+        "    andq $-16, %rsp\n"
+        "    call bcv_test_main\n"
+        "    movl %eax, %edi\n"
+        "    movl $60, %eax\n"
+        "    syscall\n");
@@ -0,0 +1,19 @@
+/*
+ * Copyright: Secure Systems Group, Aalto University https://ssg.aalto.fi/
+ * This code is released under Apache 2.0 license
+ */
+
+/* The part of the SGX trusted runtime that bcv_tramp.c uses, for the host test */
+
+#ifndef _SGX_TRTS_H_
+#define _SGX_TRTS_H_
+
+#include <stddef.h>
+
+typedef int sgx_status_t;
+
+#define SGX_SUCCESS 0
+
+sgx_status_t sgx_read_rand(unsigned char *rand, size_t length_in_bytes);
+
+#endif /* !_SGX_TRTS_H_ */
@@ -125,13 +125,18 @@ bool Enclave::exfiltrate_addresses()
 {
     auto logger = get_logger();
     sgx_status_t ret;
+    int retval = -1;
 
     logger->debug("calling ecall_setup");
-    ret = ecall_setup(m_eid);
+    ret = ecall_setup(m_eid, &retval);
     if (ret != SGX_SUCCESS) {
         print_error_message(ret);
         return false;
     }
+    if (retval != 0) {
+        logger->critical("ecall_setup: laying out the trampolines failed with error %d", retval);
+        return false;
+    }
     return true;
 }
 